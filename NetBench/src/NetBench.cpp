@@ -0,0 +1,897 @@
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <bsl_net.h>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#ifdef BSL_NET_TLS
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#endif
+
+enum class BenchMsgTypes : uint32_t {
+    Ping,
+    Data,
+    Snapshot,
+    SnapshotAck,
+};
+
+using Clock = std::chrono::steady_clock;
+
+
+// Echoes pings and counts the data it receives
+class BenchServer : public bsl::net::server_interface<BenchMsgTypes> {
+public:
+    BenchServer(uint16_t nPort) : bsl::net::server_interface<BenchMsgTypes>(nPort) {
+
+    }
+
+    // Process messages on a thread of its own until Shutdown() is called
+    void Run() {
+        thrUpdate = std::thread([this]() {
+            while (bRunning)
+                Update(-1, true);
+        });
+    }
+
+    void Shutdown() {
+        bRunning = false;
+        // Unblock Update() with a message that has no remote
+        m_qMessagesIn.push_back({});
+        if (thrUpdate.joinable()) thrUpdate.join();
+        Stop();
+    }
+
+    // Messages waiting in the outbound queues of all clients, only call once no more clients connect
+    size_t Pending() const {
+        size_t nPending = 0;
+        for (auto &client : m_deqConnections)
+            for (size_t lane = 0; lane < bsl::net::PRIORITY_LANES; lane++)
+                nPending += client->GetQueueDepth(bsl::net::priority(lane));
+        return nPending;
+    }
+
+    std::atomic<size_t> nConnected{0};
+    std::atomic<size_t> nDataMessages{0};
+    std::atomic<size_t> nDataBytes{0};
+
+protected:
+    virtual bool OnClientConnect(std::shared_ptr<bsl::net::connection<BenchMsgTypes>> client) {
+        nConnected++;
+        return true;
+    }
+
+    virtual void
+    OnMessage(std::shared_ptr<bsl::net::connection<BenchMsgTypes>> client, bsl::net::message<BenchMsgTypes> &msg) {
+        if (!client) return;
+
+        switch (msg.header.id) {
+            case BenchMsgTypes::Ping:
+                client->Send(msg);
+                break;
+
+            case BenchMsgTypes::Data:
+                nDataBytes += msg.size();
+                nDataMessages++;
+                break;
+
+            default:
+                break;
+        }
+    }
+
+private:
+    std::atomic<bool> bRunning{true};
+    std::thread thrUpdate;
+};
+
+
+class BenchClient : public bsl::net::client_interface<BenchMsgTypes> {
+public:
+    // Send a ping and wait for its echo
+    bool Ping(std::chrono::milliseconds timeout = std::chrono::milliseconds(5000)) {
+        bsl::net::message<BenchMsgTypes> msg;
+        msg.header.id = BenchMsgTypes::Ping;
+        Send(msg);
+
+        auto tEnd = Clock::now() + timeout;
+        while (Incoming().empty()) {
+            if (Clock::now() > tEnd || !IsConnected()) return false;
+            std::this_thread::yield();
+        }
+        Incoming().pop_front();
+        return true;
+    }
+
+#ifdef BSL_NET_TLS
+    bool IsSessionResumed() const {
+        return m_connection && m_connection->IsSessionResumed();
+    }
+#endif
+};
+
+
+// Checks that numbered messages arrive once each and in order
+struct SequenceCheck {
+    uint64_t nNext = 1;
+    size_t nLost = 0;
+    size_t nDuplicated = 0;
+
+    void Arrived(uint64_t n) {
+        if (n < nNext) {
+            nDuplicated++;
+        } else {
+            nLost += n - nNext;
+            nNext = n + 1;
+        }
+    }
+};
+
+// Echoes numbered data messages and checks their numbers, messages are handled by the thread that runs Update()
+class SequenceServer : public bsl::net::server_interface<BenchMsgTypes> {
+public:
+    SequenceServer(uint16_t nPort) : bsl::net::server_interface<BenchMsgTypes>(nPort) {
+
+    }
+
+    SequenceCheck check;
+
+    // Clients admitted and resumed, and how often the id messages arrive from changed
+    size_t nConnects = 0;
+    size_t nResumes = 0;
+    size_t nIdChanges = 0;
+
+protected:
+    virtual bool OnClientConnect(std::shared_ptr<bsl::net::connection<BenchMsgTypes>> client) {
+        nConnects++;
+        return true;
+    }
+
+    virtual void OnClientResumed(std::shared_ptr<bsl::net::connection<BenchMsgTypes>> client) {
+        nResumes++;
+    }
+
+    virtual void
+    OnMessage(std::shared_ptr<bsl::net::connection<BenchMsgTypes>> client, bsl::net::message<BenchMsgTypes> &msg) {
+        if (nLastId && client->GetID() != nLastId) nIdChanges++;
+        nLastId = client->GetID();
+
+        uint64_t n = 0;
+        msg >> n;
+        check.Arrived(n);
+        msg << n;
+        client->Send(msg);
+    }
+
+private:
+    uint32_t nLastId = 0;
+};
+
+// Replicates its objects to all clients, ticked by the thread that runs Update()
+class ReplicaServer : public bsl::net::server_interface<BenchMsgTypes> {
+public:
+    ReplicaServer(uint16_t nPort) : bsl::net::server_interface<BenchMsgTypes>(nPort) {
+
+    }
+
+    void Tick() {
+        replication.Tick(m_deqConnections);
+    }
+
+    bsl::net::replication_server<BenchMsgTypes> replication{BenchMsgTypes::Snapshot, BenchMsgTypes::SnapshotAck};
+
+protected:
+    virtual void
+    OnMessage(std::shared_ptr<bsl::net::connection<BenchMsgTypes>> client, bsl::net::message<BenchMsgTypes> &msg) {
+        replication.OnAck(client, msg);
+    }
+};
+
+class ReplicaClient : public bsl::net::client_interface<BenchMsgTypes> {
+public:
+    // Apply and ack every snapshot that arrived
+    void Poll() {
+        while (!Incoming().empty()) {
+            auto msg = Incoming().pop_front().msg;
+            bsl::net::message<BenchMsgTypes> ack;
+            if (replication.Apply(msg, ack))
+                Send(ack);
+        }
+    }
+
+    bsl::net::replication_client<BenchMsgTypes> replication{BenchMsgTypes::Snapshot, BenchMsgTypes::SnapshotAck};
+};
+
+
+// Connect, do one round trip and disconnect, nCount times
+template<typename MakeClient>
+void BenchHandshake(const std::string &sName, uint16_t nPort, size_t nCount, MakeClient fnMakeClient) {
+    std::unique_ptr<BenchClient> pClient;
+    size_t nFailed = 0, nResumed = 0;
+
+    auto tStart = Clock::now();
+    for (size_t i = 0; i < nCount; i++) {
+        pClient = fnMakeClient(std::move(pClient));
+
+        if (pClient->Connect("127.0.0.1", nPort) && pClient->Ping()) {
+#ifdef BSL_NET_TLS
+            if (pClient->IsSessionResumed()) nResumed++;
+#endif
+        } else {
+            nFailed++;
+        }
+        pClient->Disconnect();
+    }
+    double dSeconds = std::chrono::duration<double>(Clock::now() - tStart).count();
+
+    std::cout << "[BENCH] handshake " << sName << ": " << nCount / dSeconds << " connections/s"
+              << " (" << nResumed << " resumed, " << nFailed << " failed)\n";
+}
+
+// Stream nCount messages of nSize bytes to the server, and time until it has received all of them
+void BenchThroughput(const std::string &sName, BenchServer &server, BenchClient &client, uint16_t nPort,
+                     size_t nCount, size_t nSize) {
+    if (!client.Connect("127.0.0.1", nPort) || !client.Ping()) {
+        std::cout << "[BENCH] throughput " << sName << ": connection failed\n";
+        return;
+    }
+
+    size_t nBaseline = server.nDataMessages;
+    bsl::net::message<BenchMsgTypes> msg;
+    msg.header.id = BenchMsgTypes::Data;
+    msg.body.resize(nSize);
+    msg.header.size = msg.size();
+
+    auto tStart = Clock::now();
+    for (size_t i = 0; i < nCount; i++)
+        client.Send(msg);
+    while (server.nDataMessages - nBaseline < nCount && client.IsConnected())
+        std::this_thread::yield();
+    double dSeconds = std::chrono::duration<double>(Clock::now() - tStart).count();
+
+    std::cout << "[BENCH] throughput " << sName << ": " << nCount / dSeconds << " msgs/s, "
+              << nCount * nSize / dSeconds / (1024 * 1024) << " MiB/s\n";
+    client.Disconnect();
+}
+
+#ifdef BSL_NET_TLS
+// Generate a throwaway key and self-signed certificate, so the benchmark needs no files
+bsl::net::tls_config MakeSelfSignedConfig() {
+    EVP_PKEY_CTX *pKeyCtx = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+    EVP_PKEY_keygen_init(pKeyCtx);
+    EVP_PKEY_CTX_set_ec_paramgen_curve_nid(pKeyCtx, NID_X9_62_prime256v1);
+    EVP_PKEY *pKey = nullptr;
+    EVP_PKEY_keygen(pKeyCtx, &pKey);
+    EVP_PKEY_CTX_free(pKeyCtx);
+
+    X509 *pCert = X509_new();
+    ASN1_INTEGER_set(X509_get_serialNumber(pCert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(pCert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(pCert), 24 * 60 * 60);
+    X509_set_pubkey(pCert, pKey);
+    X509_NAME *pName = X509_get_subject_name(pCert);
+    X509_NAME_add_entry_by_txt(pName, "CN", MBSTRING_ASC, reinterpret_cast<const unsigned char *>("localhost"), -1, -1, 0);
+    X509_set_issuer_name(pCert, pName);
+    X509_sign(pCert, pKey, EVP_sha256());
+
+    auto toString = [](BIO *pBio) {
+        char *pData = nullptr;
+        long nLength = BIO_get_mem_data(pBio, &pData);
+        std::string s(pData, nLength);
+        BIO_free(pBio);
+        return s;
+    };
+
+    bsl::net::tls_config config;
+    BIO *pBio = BIO_new(BIO_s_mem());
+    PEM_write_bio_X509(pBio, pCert);
+    config.sCertificatePem = toString(pBio);
+    pBio = BIO_new(BIO_s_mem());
+    PEM_write_bio_PrivateKey(pBio, pKey, nullptr, nullptr, 0, nullptr, nullptr);
+    config.sPrivateKeyPem = toString(pBio);
+
+    X509_free(pCert);
+    EVP_PKEY_free(pKey);
+    return config;
+}
+#endif
+
+void RunHandshake(uint16_t nPort, size_t nCount) {
+    {
+        BenchServer server(nPort);
+        server.Start();
+        server.Run();
+        BenchHandshake("plaintext", nPort, nCount, [](std::unique_ptr<BenchClient> pClient) {
+            return pClient ? std::move(pClient) : std::make_unique<BenchClient>();
+        });
+        server.Shutdown();
+    }
+
+#ifdef BSL_NET_TLS
+    bsl::net::tls_config config = MakeSelfSignedConfig();
+    {
+        BenchServer server(nPort);
+        server.EnableTls(config);
+        server.Start();
+        server.Run();
+
+        // A fresh client has no session to offer, so every connection is a full handshake
+        BenchHandshake("tls full", nPort, nCount, [&](std::unique_ptr<BenchClient>) {
+            auto pClient = std::make_unique<BenchClient>();
+            pClient->EnableTls(bsl::net::tls_config{});
+            return pClient;
+        });
+
+        // Reusing the client keeps its session, so reconnects resume
+        BenchHandshake("tls resumed", nPort, nCount, [&](std::unique_ptr<BenchClient> pClient) {
+            if (!pClient) {
+                pClient = std::make_unique<BenchClient>();
+                pClient->EnableTls(bsl::net::tls_config{});
+            }
+            return pClient;
+        });
+        server.Shutdown();
+    }
+#else
+    std::cout << "[BENCH] handshake tls: skipped, build with NETCOMMON_WITH_TLS\n";
+#endif
+}
+
+void RunThroughput(uint16_t nPort, size_t nCount, size_t nSize) {
+    {
+        BenchServer server(nPort);
+        server.Start();
+        server.Run();
+        BenchClient client;
+        BenchThroughput("plaintext", server, client, nPort, nCount, nSize);
+        server.Shutdown();
+    }
+
+#ifdef BSL_NET_TLS
+    {
+        BenchServer server(nPort);
+        server.EnableTls(MakeSelfSignedConfig());
+        server.Start();
+        server.Run();
+        BenchClient client;
+        client.EnableTls(bsl::net::tls_config{});
+        BenchThroughput("tls", server, client, nPort, nCount, nSize);
+        server.Shutdown();
+    }
+#else
+    std::cout << "[BENCH] throughput tls: skipped, build with NETCOMMON_WITH_TLS\n";
+#endif
+}
+
+// Stream small messages with each wire format, at these sizes the header is a good part of the traffic. The server
+// negotiates in both runs, so the legacy run also covers a client that doesn't
+void RunWire(uint16_t nPort, size_t nCount, size_t nSize) {
+    for (auto format : {bsl::net::wire_format::legacy, bsl::net::wire_format::compact}) {
+        BenchServer server(nPort);
+        server.SetWireFormat(bsl::net::wire_format::compact);
+        server.Start();
+        server.Run();
+        BenchClient client;
+        client.SetWireFormat(format);
+        BenchThroughput(format == bsl::net::wire_format::compact ? "compact header" : "legacy header",
+                        server, client, nPort, nCount, nSize);
+        server.Shutdown();
+    }
+}
+
+// Ping round trips of a well behaved client while another one floods the server, without and with rate limits
+void RunAbuse(uint16_t nPort, size_t nCount, size_t nSize) {
+    for (bool bLimited : {false, true}) {
+        BenchServer server(nPort);
+        if (bLimited) {
+            bsl::net::rate_limit limit;
+            // 10ms worth of burst, the default of a second worth would let the flooder through unlimited for
+            // most of the run
+            limit.dMessagesPerSecond = 10000;
+            limit.dMessageBurst = 100;
+            server.SetRateLimit(limit);
+        }
+        server.Start();
+        server.Run();
+
+        BenchClient flooder, client;
+        if (!flooder.Connect("127.0.0.1", nPort) || !client.Connect("127.0.0.1", nPort) || !client.Ping()) {
+            std::cout << "[BENCH] abuse: connection failed\n";
+            server.Shutdown();
+            continue;
+        }
+
+        // Keep the flooder's outbound queue topped up, so it sends as fast as the server lets it
+        std::atomic<bool> bFlooding{true};
+        std::thread thrFlood([&]() {
+            bsl::net::message<BenchMsgTypes> msg;
+            msg.header.id = BenchMsgTypes::Data;
+            msg.body.resize(nSize);
+            msg.header.size = msg.size();
+            while (bFlooding) {
+                if (flooder.GetQueueDepth(bsl::net::priority::normal) < 1000)
+                    for (size_t i = 0; i < 100; i++)
+                        flooder.Send(msg);
+                else
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+        // Measure the steady state, once the flooder has used up its burst and the queues have filled
+        std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+        std::vector<double> vRoundTrips;
+        size_t nBaseline = server.nDataMessages;
+        auto tStart = Clock::now();
+        for (size_t i = 0; i < nCount; i++) {
+            auto tPing = Clock::now();
+            if (!client.Ping()) break;
+            vRoundTrips.push_back(std::chrono::duration<double, std::micro>(Clock::now() - tPing).count());
+        }
+        double dSeconds = std::chrono::duration<double>(Clock::now() - tStart).count();
+        size_t nFlooded = server.nDataMessages - nBaseline;
+
+        bFlooding = false;
+        thrFlood.join();
+        flooder.Disconnect();
+        client.Disconnect();
+        server.Shutdown();
+
+        std::sort(vRoundTrips.begin(), vRoundTrips.end());
+        auto percentile = [&](double d) {
+            return vRoundTrips.empty() ? 0.0 : vRoundTrips[std::min(vRoundTrips.size() - 1, size_t(d / 100 * vRoundTrips.size()))];
+        };
+        std::cout << "[BENCH] abuse " << (bLimited ? "rate limited" : "unlimited") << ": ping us p50 " << percentile(50)
+                  << ", p99 " << percentile(99) << ", max " << percentile(100) << ", flooder "
+                  << nFlooded / dSeconds << " msgs/s\n";
+    }
+}
+
+#ifndef _WIN32
+size_t ResidentBytes() {
+    std::ifstream statm("/proc/self/statm");
+    size_t nPages = 0, nResident = 0;
+    statm >> nPages >> nResident;
+    return nResident * size_t(sysconf(_SC_PAGESIZE));
+}
+#endif
+
+// Open nCount idle connections and measure what the server holds for each of them, then broadcast to all. The
+// client ends are bare sockets, so the growth of the process is the server side. Both ends live in this process
+// and need a descriptor each, the count is capped by the descriptor limit
+void RunIdle(uint16_t nPort, size_t nCount) {
+#ifndef _WIN32
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if (nCount > (limit.rlim_cur - 64) / 2) {
+            nCount = (limit.rlim_cur - 64) / 2;
+            std::cout << "[BENCH] idle: descriptor limit allows " << nCount << " connections\n";
+        }
+    }
+
+    BenchServer server(nPort);
+    server.Start();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    size_t nResidentBefore = ResidentBytes();
+
+    // Spread over 127.0.0.x so the ephemeral ports of one source address don't run out
+    std::vector<int> vSockets;
+    auto tStart = Clock::now();
+    for (size_t i = 0; i < nCount; i++) {
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(nPort);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK + uint32_t(i / 20000));
+
+        int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+            if (fd >= 0) ::close(fd);
+            std::cout << "[BENCH] idle: connection " << i << " failed\n";
+            break;
+        }
+        vSockets.push_back(fd);
+
+        // Don't outrun the accept queue
+        while (vSockets.size() - server.nConnected > 1000)
+            std::this_thread::yield();
+    }
+    auto tEnd = Clock::now() + std::chrono::seconds(10);
+    while (server.nConnected < vSockets.size() && Clock::now() < tEnd)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    double dConnectSeconds = std::chrono::duration<double>(Clock::now() - tStart).count();
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    size_t nConnections = server.nConnected;
+    size_t nResidentAfter = ResidentBytes();
+    std::cout << "[BENCH] idle: " << nConnections << " connections in " << dConnectSeconds << "s, "
+              << (nResidentAfter - nResidentBefore) / std::max<size_t>(nConnections, 1) << " bytes RSS per connection\n";
+
+    // Broadcast a small message, and time until every copy has been written
+    bsl::net::message<BenchMsgTypes> msg;
+    msg.header.id = BenchMsgTypes::Data;
+    msg << uint64_t(0);
+    auto tBroadcast = Clock::now();
+    server.MessageAllClients(msg);
+    auto queued = Clock::now() - tBroadcast;
+    while (server.Pending() > 0)
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    auto flushed = Clock::now() - tBroadcast;
+
+    auto millis = [](Clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+    std::cout << "[BENCH] idle: broadcast to " << nConnections << " connections queued in " << millis(queued)
+              << "ms, written in " << millis(flushed) << "ms\n";
+
+    for (int fd : vSockets)
+        ::close(fd);
+    server.Stop();
+#else
+    std::cout << "[BENCH] idle: skipped on this platform\n";
+#endif
+}
+
+// Replicate nObjects objects of four 16 bit fields to a few clients over 100 ticks, changing 1% of them per tick.
+// The first tick sends the full state, which is what broadcasting the state every tick would cost
+void RunReplication(uint16_t nPort, size_t nObjects) {
+    const size_t nClients = 8, nTicks = 100;
+
+    ReplicaServer server(nPort);
+    server.Start();
+    for (size_t i = 0; i < nObjects; i++)
+        server.replication.AddObject({16, 16, 16, 16});
+
+    std::vector<std::unique_ptr<ReplicaClient>> vClients;
+    for (size_t i = 0; i < nClients; i++) {
+        vClients.push_back(std::make_unique<ReplicaClient>());
+        vClients.back()->Connect("127.0.0.1", nPort);
+    }
+    // Snapshots only go to connections the server has accepted
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<uint32_t> pickObject(1, uint32_t(nObjects));
+    std::uniform_int_distribution<uint32_t> pickField(0, 3);
+    std::uniform_int_distribution<uint32_t> pickValue(0, 0xffff);
+
+    size_t nFullBytes = 0, nDeltaBytes = 0;
+    Clock::duration fullTime{0}, deltaTime{0};
+    for (size_t nTick = 0; nTick < nTicks; nTick++) {
+        if (nTick > 0)
+            for (size_t i = 0; i < nObjects / 100; i++)
+                server.replication.Set(pickObject(rng), pickField(rng), pickValue(rng));
+
+        auto tStart = Clock::now();
+        server.Tick();
+        auto elapsed = Clock::now() - tStart;
+
+        auto &stats = server.replication.Stats();
+        size_t nBytes = stats.nClientsSent ? stats.nBytes / stats.nClientsSent : 0;
+        if (nTick == 0) {
+            nFullBytes = nBytes;
+            fullTime = elapsed;
+        } else {
+            nDeltaBytes += nBytes;
+            deltaTime += elapsed;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        server.Update();
+        for (auto &pClient : vClients)
+            pClient->Poll();
+    }
+
+    // Let the last snapshots arrive, then every client must hold the same state as the server
+    auto tEnd = Clock::now() + std::chrono::seconds(5);
+    auto caughtUp = [&]() {
+        for (auto &pClient : vClients)
+            if (pClient->replication.CurrentTick() != server.replication.CurrentTick()) return false;
+        return true;
+    };
+    while (!caughtUp() && Clock::now() < tEnd) {
+        for (auto &pClient : vClients)
+            pClient->Poll();
+        std::this_thread::yield();
+    }
+    size_t nMismatches = 0;
+    for (auto &pClient : vClients)
+        for (uint32_t nObject = 1; nObject <= nObjects; nObject++)
+            for (size_t nField = 0; nField < 4; nField++)
+                if (pClient->replication.Get(nObject, nField) != server.replication.Get(nObject, nField))
+                    nMismatches++;
+
+    auto micros = [](Clock::duration d) { return std::chrono::duration<double, std::micro>(d).count(); };
+    std::cout << "[BENCH] replication full state: " << nFullBytes << " bytes/client, " << micros(fullTime) << " us/tick\n"
+              << "[BENCH] replication deltas: " << nDeltaBytes / (nTicks - 1) << " bytes/client, "
+              << micros(deltaTime) / double(nTicks - 1) << " us/tick, "
+              << (nMismatches ? std::to_string(nMismatches) + " fields differ" : std::string("clients consistent")) << "\n";
+
+    vClients.clear();
+    server.Stop();
+}
+
+// Stream numbered messages to an echo server, at most nWindow without an echo, and cut the link every nCount / nDrops
+// messages, without and with sessions. Without them what was in flight is lost, with them it is sent again after
+// reconnecting
+void RunResume(uint16_t nPort, size_t nCount, size_t nDrops, size_t nWindow = 1000) {
+    for (bool bSessions : {false, true}) {
+        SequenceServer server(nPort);
+        if (bSessions) server.EnableSessions();
+        server.Start();
+
+        BenchClient client;
+        if (bSessions) client.EnableSessions();
+        client.Connect("127.0.0.1", nPort);
+
+        SequenceCheck check;
+        auto drain = [&]() {
+            server.Update();
+            while (!client.Incoming().empty()) {
+                auto msg = client.Incoming().pop_front().msg;
+                uint64_t n = 0;
+                msg >> n;
+                check.Arrived(n);
+            }
+        };
+
+        // Time from reconnecting until the echo of the first message sent afterwards
+        double dReconnectSeconds = 0;
+        size_t nResumed = 0;
+        uint64_t nTimed = 0;
+        Clock::time_point tReconnect;
+        for (uint64_t n = 1; n <= nCount; n++) {
+            // Lost echoes never come, so don't wait for the window forever
+            auto tWindow = Clock::now();
+            while (n - check.nNext >= nWindow && Clock::now() - tWindow < std::chrono::milliseconds(100))
+                drain();
+
+            bsl::net::message<BenchMsgTypes> msg;
+            msg.header.id = BenchMsgTypes::Data;
+            msg << n;
+            client.Send(msg);
+            drain();
+
+            if (nTimed && check.nNext > nTimed) {
+                dReconnectSeconds += std::chrono::duration<double>(Clock::now() - tReconnect).count();
+                if (client.IsResumed()) nResumed++;
+                nTimed = 0;
+            }
+
+            if (n % (nCount / nDrops) == 0 && n < nCount && !nTimed) {
+                tReconnect = Clock::now();
+                client.Disconnect();
+                client.Connect("127.0.0.1", nPort);
+                nTimed = n + 1;
+            }
+        }
+
+        auto tEnd = Clock::now() + std::chrono::milliseconds(500);
+        while (check.nNext <= nCount && Clock::now() < tEnd)
+            drain();
+
+        std::cout << "[BENCH] resume " << (bSessions ? "sessions" : "plain") << ": " << nDrops - 1
+                  << " link drops, " << nResumed << " resumed, " << dReconnectSeconds / double(nDrops - 1) * 1e3
+                  << " ms to the first new echo, lost " << server.check.nLost << " upstream / " << check.nLost + (nCount + 1 - check.nNext)
+                  << " downstream, duplicated " << server.check.nDuplicated + check.nDuplicated << ", server saw "
+                  << server.nConnects << " connects, " << server.nResumes << " resumes, " << server.nIdChanges
+                  << " id changes\n";
+
+        client.Disconnect();
+        server.Stop();
+    }
+}
+
+// Admits clients after an auth check that takes a while. Synchronously in OnClientConnect() on the accept path, or
+// asynchronously on a few worker threads of its own while the accept path goes on
+class StormServer : public bsl::net::server_interface<BenchMsgTypes> {
+public:
+    StormServer(uint16_t nPort, bool bAsync, std::chrono::microseconds auth, size_t nWorkers = 16)
+            : bsl::net::server_interface<BenchMsgTypes>(nPort), bAsync(bAsync), auth(auth) {
+        for (size_t i = 0; bAsync && i < nWorkers; i++)
+            vWorkers.emplace_back([this]() {
+                std::unique_lock<std::mutex> lock(muxChecks);
+                while (true) {
+                    cvChecks.wait(lock, [this]() { return !bRunning || !deqChecks.empty(); });
+                    if (!bRunning) return;
+                    auto fnCheck = std::move(deqChecks.front());
+                    deqChecks.pop_front();
+                    lock.unlock();
+                    fnCheck();
+                    lock.lock();
+                }
+            });
+    }
+
+    ~StormServer() {
+        {
+            std::scoped_lock lock(muxChecks);
+            bRunning = false;
+        }
+        cvChecks.notify_all();
+        for (auto &thread : vWorkers)
+            thread.join();
+        Stop();
+    }
+
+protected:
+    virtual bool OnClientConnect(std::shared_ptr<bsl::net::connection<BenchMsgTypes>> client) {
+        std::this_thread::sleep_for(auth);
+        return true;
+    }
+
+    virtual void OnClientConnectAsync(std::shared_ptr<bsl::net::connection<BenchMsgTypes>> client,
+                                      std::function<void(bool)> fnAdmit) {
+        if (!bAsync) {
+            fnAdmit(OnClientConnect(client));
+            return;
+        }
+        {
+            std::scoped_lock lock(muxChecks);
+            deqChecks.push_back([this, fnAdmit]() {
+                std::this_thread::sleep_for(auth);
+                fnAdmit(true);
+            });
+        }
+        cvChecks.notify_one();
+    }
+
+private:
+    bool bAsync;
+    std::chrono::microseconds auth;
+    std::mutex muxChecks;
+    std::condition_variable cvChecks;
+    std::deque<std::function<void()>> deqChecks;
+    bool bRunning = true;
+    std::vector<std::thread> vWorkers;
+};
+
+// nCount clients connect at the same moment, like after a server restart, and each needs a 1ms auth check. Time
+// until all are admitted, with one accept at a time and the check on the accept path, and with batched accepts,
+// a deeper backlog and the checks off the accept path
+void RunStorm(uint16_t nPort, size_t nCount) {
+#ifndef _WIN32
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+        if (nCount > (limit.rlim_cur - 64) / 2) {
+            nCount = (limit.rlim_cur - 64) / 2;
+            std::cout << "[BENCH] storm: descriptor limit allows " << nCount << " connections\n";
+        }
+    }
+
+    for (bool bBatched : {false, true}) {
+        StormServer server(nPort, bBatched, std::chrono::microseconds(1000));
+        server.SetConnectionLogging(false);
+        if (bBatched) {
+            server.SetAcceptConcurrency(64);
+            server.SetListenBacklog(65535);
+        }
+        server.Start();
+
+        // Start every connect without waiting for it, the kernel completes them as the backlog allows
+        std::vector<int> vSockets;
+        auto tStart = Clock::now();
+        for (size_t i = 0; i < nCount; i++) {
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(nPort);
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK + uint32_t(i / 20000));
+
+            int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+            if (fd < 0) break;
+            ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL) | O_NONBLOCK);
+            ::connect(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address));
+            vSockets.push_back(fd);
+        }
+
+        auto tEnd = Clock::now() + std::chrono::seconds(120);
+        while (server.GetAcceptStats().nAdmitted < vSockets.size() && Clock::now() < tEnd)
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        double dSeconds = std::chrono::duration<double>(Clock::now() - tStart).count();
+
+        // Let the rate window the burst ended in close
+        std::this_thread::sleep_for(bsl::net::ACCEPT_RATE_WINDOW * 2);
+        auto stats = server.GetAcceptStats();
+        std::cout << "[BENCH] storm " << (bBatched ? "batched, async admission" : "one accept, sync admission")
+                  << ": " << stats.nAdmitted << "/" << vSockets.size() << " admitted in " << dSeconds
+                  << "s, peak " << stats.nPeakRate << " accepts/s, " << stats.nErrors << " accept errors\n";
+
+        for (int fd : vSockets)
+            ::close(fd);
+    }
+#else
+    std::cout << "[BENCH] storm: skipped on this platform\n";
+#endif
+}
+
+// Round trips of pings sent in bursts after the link was idle, with the io threads and consumers sleeping until
+// there is work, and with them spinning for spin first. Every spinning thread needs a core of its own, there are
+// four here
+void RunPoll(uint16_t nPort, size_t nBursts, size_t nBurst = 8, std::chrono::microseconds spin = std::chrono::microseconds(200)) {
+    for (bool bSpin : {false, true}) {
+        BenchServer server(nPort);
+        if (bSpin) server.SetBusyPoll(spin);
+        server.Start();
+        server.Run();
+
+        BenchClient client;
+        if (bSpin) client.SetBusyPoll(spin);
+        if (!client.Connect("127.0.0.1", nPort) || !client.Ping()) {
+            std::cout << "[BENCH] poll: connection failed\n";
+            server.Shutdown();
+            continue;
+        }
+
+        std::vector<double> vRoundTrips;
+        std::clock_t tCpuStart = std::clock();
+        for (size_t i = 0; i < nBursts; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            for (size_t j = 0; j < nBurst; j++) {
+                bsl::net::message<BenchMsgTypes> msg;
+                msg.header.id = BenchMsgTypes::Ping;
+                auto tPing = Clock::now();
+                client.Send(msg);
+                client.Incoming().wait(client.GetBusyPoll().spin);
+                client.Incoming().pop_front();
+                vRoundTrips.push_back(std::chrono::duration<double, std::micro>(Clock::now() - tPing).count());
+            }
+        }
+        double dCpuSeconds = double(std::clock() - tCpuStart) / CLOCKS_PER_SEC;
+
+        client.Disconnect();
+        server.Shutdown();
+
+        std::sort(vRoundTrips.begin(), vRoundTrips.end());
+        auto percentile = [&](double d) {
+            return vRoundTrips.empty() ? 0.0 : vRoundTrips[std::min(vRoundTrips.size() - 1, size_t(d / 100 * vRoundTrips.size()))];
+        };
+        std::cout << "[BENCH] poll " << (bSpin ? "spin" : "blocking") << ": round trip us p50 " << percentile(50)
+                  << ", p90 " << percentile(90) << ", p99 " << percentile(99) << ", max " << percentile(100)
+                  << ", cpu " << dCpuSeconds * 1e6 / double(vRoundTrips.size()) << " us per round trip on "
+                  << std::thread::hardware_concurrency() << " cores\n";
+    }
+}
+
+int main(int argc, char *argv[]) {
+    std::string sScenario = argc > 1 ? argv[1] : "all";
+    size_t nCount = argc > 2 ? std::stoul(argv[2]) : 0;
+    size_t nSize = argc > 3 ? std::stoul(argv[3]) : 0;
+    uint16_t nPort = 2697;
+
+    if (sScenario == "handshake" || sScenario == "all")
+        RunHandshake(nPort, nCount ? nCount : 500);
+    if (sScenario == "throughput" || sScenario == "all")
+        RunThroughput(nPort, nCount ? nCount : 100000, nSize ? nSize : 1024);
+    if (sScenario == "wire" || sScenario == "all")
+        RunWire(nPort, nCount ? nCount : 200000, nSize ? nSize : 8);
+    if (sScenario == "replication" || sScenario == "all")
+        RunReplication(nPort, nCount ? nCount : 10000);
+    if (sScenario == "abuse" || sScenario == "all")
+        RunAbuse(nPort, nCount ? nCount : 1000, nSize ? nSize : 64);
+    if (sScenario == "idle" || sScenario == "all")
+        RunIdle(nPort, nCount ? nCount : 100000);
+    if (sScenario == "resume" || sScenario == "all")
+        RunResume(nPort, nCount ? nCount : 100000, nSize ? nSize : 20);
+    if (sScenario == "poll" || sScenario == "all")
+        RunPoll(nPort, nCount ? nCount : 1000, nSize ? nSize : 8);
+    if (sScenario == "storm" || sScenario == "all")
+        RunStorm(nPort, nCount ? nCount : 5000);
+
+    if (sScenario != "all" && sScenario != "handshake" && sScenario != "throughput" && sScenario != "wire" &&
+        sScenario != "replication" && sScenario != "abuse" && sScenario != "idle" && sScenario != "resume" &&
+        sScenario != "poll" && sScenario != "storm") {
+        std::cout << "Usage: NetBench [all|handshake|throughput|wire|replication|abuse|idle|resume|poll|storm] [count] [size]\n";
+        return 1;
+    }
+
+    return 0;
+}
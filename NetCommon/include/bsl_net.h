@@ -1,8 +1,19 @@
 #pragma once
 
 #include "net_common.h"
+#include "net_trace.h"
+#include "net_poll.h"
 #include "net_tsqueue.h"
 #include "net_message.h"
+#include "net_memory.h"
+#include "net_rate.h"
+#include "net_pool.h"
+#include "net_priority.h"
+#include "net_tls.h"
+#include "net_capture.h"
+#include "net_wire.h"
+#include "net_session.h"
 #include "net_client.h"
 #include "net_server.h"
-#include "net_connection.h"
\ No newline at end of file
+#include "net_connection.h"
+#include "net_replication.h"
\ No newline at end of file
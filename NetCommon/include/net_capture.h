@@ -0,0 +1,272 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace bsl {
+    namespace net {
+        // A capture file starts with this header, followed by records back to back. Everything is in the byte
+        // order of the machine that recorded
+        struct capture_file_header {
+            char magic[8] = {'B', 'S', 'L', 'C', 'A', 'P', '0', '2'};
+            // sizeof(capture_message_header) when it was recorded
+            uint32_t nMessageHeaderSize = 0;
+            // Which side recorded the traffic, 0 for a server and 1 for a client
+            uint8_t nRole = 0;
+            uint8_t reserved[3]{};
+            // Bytes of records written, only valid once the capture was closed cleanly
+            uint64_t nDataSize = 0;
+        };
+
+        enum class capture_direction : uint8_t {
+            inbound,
+            outbound
+        };
+
+        // The message header as it is recorded, whatever the id type and layout of message_header<T>
+        struct capture_message_header {
+            uint64_t nId = 0;
+            uint32_t nSize = 0;
+            uint8_t nFlags = 0;
+            uint8_t reserved[3]{};
+        };
+
+        static_assert(sizeof(capture_message_header) == 16, "The message header is recorded as is");
+
+        template<typename T>
+        capture_message_header capture_encode_header(const message_header<T> &header) {
+            capture_message_header out;
+            out.nId = uint64_t(header.id);
+            out.nSize = header.size;
+            out.nFlags = header.flags;
+            return out;
+        }
+
+        template<typename T>
+        message_header<T> capture_decode_header(const capture_message_header &in) {
+            message_header<T> header;
+            header.id = T(in.nId);
+            header.size = in.nSize;
+            header.flags = in.nFlags;
+            return header;
+        }
+
+        // Every record is this header, then the capture_message_header, then the body
+        struct capture_record {
+            uint64_t nTimestamp = 0;      // steady clock, nanoseconds
+            uint32_t nConnectionId = 0;
+            capture_direction direction = capture_direction::inbound;
+            uint8_t reserved[3]{};
+            uint32_t nFrameSize = 0;      // message header + body
+            uint32_t nPadding = 0;
+        };
+
+        // Append only capture of every frame to a memory mapped file. The whole capacity is mapped up front so
+        // recording never remaps, writers reserve their space with a single atomic add and copy into it.
+        // When the capacity is used up, further frames are counted as dropped
+        class capture_writer {
+        public:
+            capture_writer() = default;
+
+            capture_writer(const capture_writer &) = delete;
+
+            ~capture_writer() {
+                Close();
+            }
+
+        public:
+            bool Open(const std::string &sPath, uint8_t nRole, size_t nCapacity) {
+#ifndef _WIN32
+                Close();
+
+                int fd = ::open(sPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+                if (fd < 0) {
+                    std::cerr << "[CAPTURE] Can't open " << sPath << "\n";
+                    return false;
+                }
+
+                // The file is sparse, disk space is only used as records are written
+                size_t nFileSize = sizeof(capture_file_header) + nCapacity;
+                void *pMapping = MAP_FAILED;
+                if (::ftruncate(fd, off_t(nFileSize)) == 0)
+                    pMapping = ::mmap(nullptr, nFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (pMapping == MAP_FAILED) {
+                    std::cerr << "[CAPTURE] Can't map " << sPath << "\n";
+                    ::close(fd);
+                    return false;
+                }
+
+                m_fd = fd;
+                m_pMapping = static_cast<uint8_t *>(pMapping);
+                m_nMappingSize = nFileSize;
+                m_nCapacity = nCapacity;
+                m_nOffset.store(0);
+                m_nEnd.store(SIZE_MAX);
+                m_nDropped.store(0);
+
+                capture_file_header header;
+                header.nMessageHeaderSize = uint32_t(sizeof(capture_message_header));
+                header.nRole = nRole;
+                std::memcpy(m_pMapping, &header, sizeof(header));
+
+                m_bOpen.store(true, std::memory_order_release);
+                return true;
+#else
+                std::cerr << "[CAPTURE] Not supported on this platform\n";
+                return false;
+#endif
+            }
+
+            // Stop recording, wait for writers still copying, then trim the file to what was written
+            void Close() {
+#ifndef _WIN32
+                if (!m_bOpen.exchange(false)) return;
+
+                while (m_nWriters.load() != 0)
+                    std::this_thread::yield();
+
+                size_t nDataSize = std::min(m_nOffset.load(), m_nEnd.load());
+                reinterpret_cast<capture_file_header *>(m_pMapping)->nDataSize = nDataSize;
+
+                ::munmap(m_pMapping, m_nMappingSize);
+                if (::ftruncate(m_fd, off_t(sizeof(capture_file_header) + nDataSize)) != 0)
+                    std::cerr << "[CAPTURE] Can't trim capture file\n";
+                ::close(m_fd);
+
+                m_pMapping = nullptr;
+                m_fd = -1;
+#endif
+            }
+
+            bool IsOpen() const {
+                return m_bOpen.load(std::memory_order_relaxed);
+            }
+
+            // Frames that didn't fit in the capacity
+            size_t Dropped() const {
+                return m_nDropped.load(std::memory_order_relaxed);
+            }
+
+            void Record(uint32_t nConnectionId, capture_direction direction,
+                        const void *pHeader, size_t nHeaderSize, const void *pBody, size_t nBodySize) {
+                // Callers check IsOpen() first, so a disabled capture costs one relaxed load
+                // Close() clears m_bOpen and then waits for m_nWriters, so both have to be sequentially consistent
+                m_nWriters.fetch_add(1);
+                if (m_bOpen.load()) {
+                    // Keep records 8 byte aligned
+                    size_t nRecordSize = (sizeof(capture_record) + nHeaderSize + nBodySize + 7) & ~size_t(7);
+                    size_t nOffset = m_nOffset.fetch_add(nRecordSize, std::memory_order_relaxed);
+
+                    if (nOffset + nRecordSize <= m_nCapacity) {
+                        capture_record record;
+                        record.nTimestamp = uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::steady_clock::now().time_since_epoch()).count());
+                        record.nConnectionId = nConnectionId;
+                        record.direction = direction;
+                        record.nFrameSize = uint32_t(nHeaderSize + nBodySize);
+
+                        uint8_t *p = m_pMapping + sizeof(capture_file_header) + nOffset;
+                        std::memcpy(p, &record, sizeof(record));
+                        std::memcpy(p + sizeof(record), pHeader, nHeaderSize);
+                        if (nBodySize > 0)
+                            std::memcpy(p + sizeof(record) + nHeaderSize, pBody, nBodySize);
+                    } else {
+                        // Offsets only grow, so the lowest one that didn't fit is where the data ends
+                        size_t nEnd = m_nEnd.load(std::memory_order_relaxed);
+                        while (nOffset < nEnd && !m_nEnd.compare_exchange_weak(nEnd, nOffset, std::memory_order_relaxed));
+                        m_nDropped.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+                m_nWriters.fetch_sub(1);
+            }
+
+        private:
+            std::atomic<bool> m_bOpen{false};
+            std::atomic<size_t> m_nWriters{0};
+            std::atomic<size_t> m_nOffset{0};
+            std::atomic<size_t> m_nEnd{SIZE_MAX};
+            std::atomic<size_t> m_nDropped{0};
+
+            int m_fd = -1;
+            uint8_t *m_pMapping = nullptr;
+            size_t m_nMappingSize = 0;
+            size_t m_nCapacity = 0;
+        };
+
+        // Sequential reader of a closed capture file
+        class capture_reader {
+        public:
+            capture_reader() = default;
+
+            capture_reader(const capture_reader &) = delete;
+
+            ~capture_reader() {
+#ifndef _WIN32
+                if (m_pMapping) ::munmap(const_cast<uint8_t *>(m_pMapping), m_nMappingSize);
+#endif
+            }
+
+        public:
+            bool Open(const std::string &sPath) {
+#ifndef _WIN32
+                int fd = ::open(sPath.c_str(), O_RDONLY);
+                if (fd < 0) return false;
+
+                struct stat st{};
+                void *pMapping = MAP_FAILED;
+                if (::fstat(fd, &st) == 0 && size_t(st.st_size) >= sizeof(capture_file_header))
+                    pMapping = ::mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                ::close(fd);
+                if (pMapping == MAP_FAILED) return false;
+
+                m_pMapping = static_cast<const uint8_t *>(pMapping);
+                m_nMappingSize = size_t(st.st_size);
+                std::memcpy(&m_header, m_pMapping, sizeof(m_header));
+
+                const capture_file_header reference;
+                if (std::memcmp(m_header.magic, reference.magic, sizeof(reference.magic)) != 0)
+                    return false;
+
+                // Never trust the recorded size beyond what the file holds
+                m_nDataSize = std::min<size_t>(m_header.nDataSize, m_nMappingSize - sizeof(capture_file_header));
+                m_nOffset = 0;
+                return true;
+#else
+                return false;
+#endif
+            }
+
+            const capture_file_header &Header() const {
+                return m_header;
+            }
+
+            // Fetch the next record, pFrame points at the capture_message_header followed by the body
+            bool Next(capture_record &record, const uint8_t *&pFrame) {
+                const uint8_t *pData = m_pMapping + sizeof(capture_file_header);
+                if (m_nOffset + sizeof(capture_record) > m_nDataSize) return false;
+
+                std::memcpy(&record, pData + m_nOffset, sizeof(record));
+                size_t nRecordSize = (sizeof(capture_record) + record.nFrameSize + 7) & ~size_t(7);
+                if (m_nOffset + sizeof(capture_record) + record.nFrameSize > m_nDataSize) return false;
+
+                pFrame = pData + m_nOffset + sizeof(capture_record);
+                m_nOffset += nRecordSize;
+                return true;
+            }
+
+        private:
+            capture_file_header m_header;
+            const uint8_t *m_pMapping = nullptr;
+            size_t m_nMappingSize = 0;
+            size_t m_nDataSize = 0;
+            size_t m_nOffset = 0;
+        };
+    }
+}
@@ -1,13 +1,24 @@
 #pragma once
 
 #include "net_common.h"
+#include "net_tls.h"
+#include "net_priority.h"
+#include "net_capture.h"
+#include "net_wire.h"
+#include "net_session.h"
+#include "net_poll.h"
 
 namespace bsl {
     namespace net {
         template<typename T>
         class client_interface {
         public:
-            client_interface() {}
+            // The client runs its own context on a thread of its own
+            client_interface() : m_pOwnedContext(std::make_unique<asio::io_context>()), m_context(*m_pOwnedContext) {}
+
+            // The client runs on a context shared with other clients. The caller runs it, on as many threads as
+            // it likes, and has to keep it alive and running for as long as the client is connected
+            explicit client_interface(asio::io_context &context) : m_context(context) {}
 
             virtual ~client_interface() {
                 // If the client is destroyed, always try and disconnect from server
@@ -23,14 +34,34 @@ namespace bsl {
                     asio::ip::tcp::resolver::results_type endpoints = resolver.resolve(host, std::to_string(port));
 
                     // Create connection
-                    m_connection = std::make_unique<connection<T>>(connection<T>::owner::client, m_context,
-                                                                   asio::ip::tcp::socket(m_context), m_qMessagesIn);
+                    m_connection = std::make_shared<connection<T>>(connection<T>::owner::client, m_context,
+                                                                   asio::ip::tcp::socket(asio::make_strand(m_context)),
+                                                                   m_pShared->qMessagesIn);
+                    m_connection->SetOwnerState(m_pShared);
+                    m_connection->SetLanePolicy(&m_pShared->lanePolicy);
+                    m_connection->SetCapture(&m_pShared->capture);
+                    m_connection->SetWireFormat(m_wireFormat);
+                    if (m_pShared->pFrameLimits)
+                        m_connection->SetMemoryBudget(nullptr, m_pShared->pFrameLimits.get());
+                    if (m_pShared->busyPoll.Enabled())
+                        m_connection->SetBusyPoll(&m_pShared->busyPoll);
+                    if (m_pSession)
+                        m_connection->SetSession(m_pSession);
+#ifdef BSL_NET_TLS
+                    // Sessions are remembered per server, so reconnecting to it can skip the full handshake
+                    if (m_pShared->pTlsContext)
+                        m_connection->EnableTls(m_pShared->pTlsContext->Native(), m_pShared->pTlsContext.get(),
+                                                host + ":" + std::to_string(port), host);
+#endif
 
                     // Tell the connection object to connect to server
                     m_connection->ConnectToServer(endpoints);
 
-                    // Start Context Thread
-                    thrContext = std::thread([this]() { m_context.run(); });
+                    // Start Context Thread, the context may have been stopped by an earlier Disconnect()
+                    if (m_pOwnedContext) {
+                        m_context.restart();
+                        thrContext = std::thread([this]() { run_context(m_context, m_pShared->busyPoll); });
+                    }
                 }
                 catch (std::exception &e) {
                     std::cerr << "Client Exception: " << e.what() << "\n";
@@ -41,6 +72,20 @@ namespace bsl {
 
             // Disconnect from server
             void Disconnect() {
+                if (!m_pOwnedContext) {
+                    // A shared context keeps running, close on the connection's strand and wait for it. A stopped
+                    // one runs nothing, close right here. Either way the handlers still queued only touch the
+                    // connection and the state it shares
+                    if (m_connection) {
+                        if (!m_context.stopped())
+                            m_connection->DisconnectAndWait();
+                        else
+                            m_connection->Close();
+                    }
+                    m_connection.reset();
+                    return;
+                }
+
                 if (IsConnected()) {
                     // disconnect from server
                     m_connection->Disconnect();
@@ -51,8 +96,17 @@ namespace bsl {
                 if (thrContext.joinable())
                     thrContext.join();
 
+                // The close posted above and the handlers it aborts still refer to the connection, run them
+                // now, or they would run on the next Connect() after the connection is gone
+                m_context.restart();
+                m_context.poll();
+
+                // Nothing runs anymore, leave what wasn't sent with the session before the next Connect() resumes it
+                if (m_connection)
+                    m_connection->Close();
+
                 // Destroy the connection object
-                m_connection.release();
+                m_connection.reset();
             }
 
             // Check if client is actually connected to a server
@@ -63,6 +117,14 @@ namespace bsl {
                     return false;
             }
 
+#ifdef BSL_NET_TLS
+            // Connect over TLS from now on, call before Connect(). The server's certificate is only checked, against
+            // config.sVerifyFile and the host given to Connect(), with config.bVerifyPeer set
+            void EnableTls(const tls_config &config) {
+                m_pShared->pTlsContext = std::make_unique<tls_client_context>(config);
+            }
+#endif
+
         public:
             // Send message to server
             void Send(const message <T> &msg) {
@@ -70,21 +132,136 @@ namespace bsl {
                     m_connection->Send(msg);
             }
 
+            // Send message to server in a specific lane, regardless of its id
+            void Send(const message <T> &msg, priority lane) {
+                if (IsConnected())
+                    m_connection->Send(msg, lane);
+            }
+
+            // Send messages with this id in a specific lane
+            void SetPriority(T id, priority lane) {
+                m_pShared->lanePolicy.SetPriority(id, lane);
+            }
+
+            // Bytes a weighted lane may send per round when lanes compete
+            void SetLaneQuantum(priority lane, size_t nBytes) {
+                m_pShared->lanePolicy.SetQuantum(lane, nBytes);
+            }
+
+            // Number of messages waiting to be sent in a lane
+            size_t GetQueueDepth(priority lane) {
+                return m_connection ? m_connection->GetQueueDepth(lane) : 0;
+            }
+
+            // Disconnect from a server that announces a message body bigger than nMaxSize, or than the limit of its
+            // id. Without a limit any size is accepted. Call before Connect()
+            void SetMaxFrameSize(uint32_t nMaxSize) {
+                if (!m_pShared->pFrameLimits)
+                    m_pShared->pFrameLimits = std::make_unique<frame_limits<T>>();
+                m_pShared->pFrameLimits->SetDefault(nMaxSize);
+            }
+
+            void SetMaxFrameSize(T id, uint32_t nMaxSize) {
+                if (!m_pShared->pFrameLimits) {
+                    m_pShared->pFrameLimits = std::make_unique<frame_limits<T>>();
+                    m_pShared->pFrameLimits->SetDefault(UINT32_MAX);
+                }
+                m_pShared->pFrameLimits->Set(id, nMaxSize);
+            }
+
+            // Ask the server for the compact wire format on the next Connect(). The server has to negotiate, one that
+            // doesn't would take the hello for a message
+            void SetWireFormat(wire_format format) {
+                m_wireFormat = format;
+            }
+
+            // The wire format agreed with the server
+            wire_format GetWireFormat() const {
+                return m_connection ? m_connection->GetWireFormat() : m_wireFormat;
+            }
+
+            // Keep a session with the server across connections: after Disconnect() and Connect() it is resumed,
+            // messages lost with the old connection are sent again in both directions and nothing arrives twice.
+            // Up to nMaxReplayBytes of messages the server hasn't acknowledged are kept. The server has to enable
+            // sessions too, they need the compact wire format so this asks for it. Call before Connect()
+            void EnableSessions(size_t nMaxReplayBytes = DEFAULT_REPLAY_BYTES) {
+                m_pSession = std::make_shared<session<T>>(0, 0, nMaxReplayBytes);
+                m_wireFormat = wire_format::compact;
+            }
+
+            // True once the current connection resumed the session. False after it started a new one, because
+            // the server had forgotten the old one or the session wasn't agreed, then anything in flight is lost
+            bool IsResumed() const {
+                return m_connection && m_connection->IsResumed();
+            }
+
+            // Trade cores for latency: the client's own context thread spins for up to spin before it sleeps, and
+            // the socket gets TCP_NODELAY and SO_BUSY_POLL of nSocketMicros. Consumers of Incoming() spin as well
+            // with Incoming().wait(GetBusyPoll().spin). A shared context is run by the caller, run_context() spins
+            // for it. Call before Connect()
+            void SetBusyPoll(std::chrono::microseconds spin, int nSocketMicros = 50) {
+                m_pShared->busyPoll.spin = spin;
+                m_pShared->busyPoll.nSocketMicros = nSocketMicros;
+            }
+
+            const busy_poll &GetBusyPoll() const {
+                return m_pShared->busyPoll;
+            }
+
+            // Record the traffic with the server to a memory mapped file of at most nCapacity bytes
+            bool StartCapture(const std::string &sPath, size_t nCapacity = size_t(1) << 30) {
+                return m_pShared->capture.Open(sPath, 1, nCapacity);
+            }
+
+            void StopCapture() {
+                m_pShared->capture.Close();
+            }
+
             // Retrieve queue of messages from server
             tsqueue <owned_message<T>> &Incoming() {
-                return m_qMessagesIn;
+                return m_pShared->qMessagesIn;
             }
 
         protected:
-            // asio context handles the data transfer and a thread to run asio context
-            asio::io_context m_context;
+            // asio context handles the data transfer and a thread to run asio context. The context is either
+            // owned by the client, or shared with others and run by the caller, in which case there is no thread
+            std::unique_ptr<asio::io_context> m_pOwnedContext;
+            asio::io_context &m_context;
             std::thread thrContext;
-            // The client has a single instance of a "connection" object, which handles data transfer
-            std::unique_ptr<connection < T>> m_connection;
 
-        private:
-            // This is the thread safe queue of incoming messages from server
-            tsqueue <owned_message<T>> m_qMessagesIn;
+            // Everything the connection refers to. The connection shares it, so handlers still queued on a shared
+            // context find it alive after the client is gone
+            struct shared_state {
+                // This is the thread safe queue of incoming messages from server
+                tsqueue<owned_message<T>> qMessagesIn;
+
+                // Outbound lanes configuration
+                lane_policy<T> lanePolicy;
+
+                // Traffic capture, idle until StartCapture()
+                capture_writer capture;
+
+                // Low latency mode, off unless SetBusyPoll()
+                busy_poll busyPoll;
+
+                // Inbound frame size limits, none unless SetMaxFrameSize()
+                std::unique_ptr<frame_limits<T>> pFrameLimits;
+
+#ifdef BSL_NET_TLS
+                // Keeps the sessions of earlier connections
+                std::unique_ptr<tls_client_context> pTlsContext;
+#endif
+            };
+            std::shared_ptr<shared_state> m_pShared = std::make_shared<shared_state>();
+
+            // Wire format asked for when connecting
+            wire_format m_wireFormat = wire_format::legacy;
+
+            // Session resumed by every Connect(), if enabled
+            std::shared_ptr<session<T>> m_pSession;
+
+            // The client has a single instance of a "connection" object, which handles data transfer
+            std::shared_ptr<connection < T>> m_connection;
         };
     }
 }
\ No newline at end of file
@@ -6,10 +6,19 @@
 #include <deque>
 #include <optional>
 #include <vector>
+#include <array>
 #include <iostream>
 #include <algorithm>
 #include <chrono>
 #include <cstdint>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+#include <map>
+#include <list>
+#include <condition_variable>
+#include <future>
+#include <random>
 
 #ifdef _WIN32
 #define _WIN32_WINNT 0x0A00
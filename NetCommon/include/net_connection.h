@@ -3,6 +3,14 @@
 #include "net_common.h"
 #include "net_tsqueue.h"
 #include "net_message.h"
+#include "net_memory.h"
+#include "net_rate.h"
+#include "net_priority.h"
+#include "net_tls.h"
+#include "net_capture.h"
+#include "net_poll.h"
+#include "net_wire.h"
+#include "net_session.h"
 
 
 namespace bsl {
@@ -16,6 +24,41 @@ namespace bsl {
                 client
             };
 
+        protected:
+            // Session state of a connection: the hello exchanged, messages the remote missed with the previous
+            // connection of the session, and the acks
+            struct session_link {
+                session_hello sessionAsked;
+                std::array<uint8_t, SESSION_HELLO_SIZE> aSessionHello{};
+                std::deque<message<T>> deqReplay;
+
+                // Messages received in total and how many of them the remote was told about, messages the remote
+                // received in total, and the increment carried by the header just read
+                uint64_t nReceived = 0;
+                uint64_t nAckSent = 0;
+                uint64_t nRemoteReceived = 0;
+                uint64_t nAckIn = 0;
+                bool bFrameIsMessage = true;
+                bool bAckDue = false;
+                bool bAckTimerArmed = false;
+                std::unique_ptr<asio::steady_timer> timerAck;
+
+                // A server settles the session before it admits the client: who is told once it is settled, and
+                // what is left to do once the client is admitted
+                std::function<void(std::shared_ptr<connection<T>>, bool)> fnNegotiated;
+                bool bAwaitingAdmission = false;
+                bool bStartSession = false;
+                size_t nHeaderBytesRead = 0;
+            };
+
+            // Marks of the traced messages being read, queued and written. Queued ones are found by their address
+            // in the lanes, which doesn't change until they are popped
+            struct trace_state {
+                trace_mark traceIn;
+                trace_mark traceOut;
+                std::vector<std::pair<const message<T> *, trace_mark>> vTracedOut;
+            };
+
         public:
             // Constructor: Specify Owner, connect to context, transfer the socket, incoming message queue
             connection(owner parent, asio::io_context &asioContext, asio::ip::tcp::socket socket,
@@ -24,40 +67,281 @@ namespace bsl {
                 m_nOwnerType = parent;
             }
 
-            virtual ~connection() {}
+            ~connection() {
+                // Nothing runs on the strand anymore, whatever wasn't sent stays with the session
+                DetachSession();
+#ifdef BSL_NET_TLS
+                // We never send close_notify, so tell OpenSSL the session ended cleanly. Otherwise it is marked as
+                // not resumable when the SSL object is freed
+                if (m_sslStream && m_bEstablished)
+                    SSL_set_shutdown(m_sslStream->native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+#endif
+            }
 
             // This ID is used system wide
             uint32_t GetID() const {
                 return id;
             }
 
+            // Attach the memory budget and frame limits of the owner, either may be null. Must be called before the
+            // connection starts reading
+            void SetMemoryBudget(memory_budget *pBudget, const frame_limits<T> *pFrameLimits) {
+                m_pMemoryBudget = pBudget;
+                m_pFrameLimits = pFrameLimits;
+            }
+
+            // Attach the server wide inbound rate limits, must be called before the connection starts reading
+            void SetRateLimits(const rate_limits<T> *pRateLimits) {
+                m_pRateLimits = pRateLimits && pRateLimits->Enabled() ? pRateLimits : nullptr;
+            }
+
+            // Number of times reading was paused because the remote went over its rate limits
+            size_t GetThrottleCount() const {
+                return m_nThrottled.load(std::memory_order_relaxed);
+            }
+
+            // Keep what the owner shares with the connection alive for as long as the connection is, handlers may
+            // outlive the owner
+            void SetOwnerState(std::shared_ptr<void> pState) {
+                m_pOwnerState = std::move(pState);
+            }
+
+            // Attach the lanes configuration of the owner, must be called before anything is sent
+            void SetLanePolicy(const lane_policy<T> *pPolicy) {
+                m_pLanePolicy = pPolicy;
+                m_qMessagesOut.SetPolicy(pPolicy);
+            }
+
+            // Record every frame sent and received to the owner's capture while it is open
+            void SetCapture(capture_writer *pCapture) {
+                m_pCapture = pCapture;
+            }
+
+            // Time the messages the owner's tracer samples through the connection's stages while it is enabled
+            void SetTracer(tracer *pTracer) {
+                m_pTracer = pTracer;
+            }
+
+            // Set the socket options of the owner's low latency mode once connected, must be called before
+            // ConnectToClient/ConnectToServer
+            void SetBusyPoll(const busy_poll *pBusyPoll) {
+                m_pBusyPoll = pBusyPoll;
+            }
+
+            // Offer the compact wire format, must be called before ConnectToClient/ConnectToServer. Clients ask for it
+            // in a hello and wait for the answer, so only use it with servers that negotiate. Servers answer hellos
+            // and keep speaking legacy to clients that don't send one
+            void SetWireFormat(wire_format format) {
+                m_wireFormat.store(format);
+            }
+
+            // The wire format agreed with the remote, the offered one until then
+            wire_format GetWireFormat() const {
+                return m_wireFormat.load(std::memory_order_relaxed);
+            }
+
+            // Keep this client connection's messages in a session that a later connection can resume, must be called
+            // before ConnectToServer. The server has to have sessions enabled, otherwise the session is not used
+            void SetSession(std::shared_ptr<session<T>> pSession) {
+                m_pSession = std::move(pSession);
+            }
+
+            // Let clients start and resume sessions of this server, must be called before ConnectToClient
+            void SetSessionTable(session_table<T> *pSessions) {
+                m_pSessions = pSessions;
+            }
+
+            // True once the connection has resumed an earlier session, instead of starting a new one. Messages
+            // lost with the earlier connection are sent again, in order, and it keeps the id of that connection
+            bool IsResumed() const {
+                return m_bResumed.load();
+            }
+
+            // True once another connection has resumed the session of this one, it is the same client
+            bool IsSuperseded() const {
+                return m_bSuperseded.load();
+            }
+
+            // The session the connection carries, null if it has none. It is settled before the first message arrives
+            const session<T> *GetSession() const {
+                return m_pSession.get();
+            }
+
+            // Number of messages waiting to be sent in a lane
+            size_t GetQueueDepth(priority lane) const {
+                return m_qMessagesOut.depth(lane);
+            }
+
+            // Bytes of the memory budget currently held by this connection's receive buffer and queued messages
+            size_t GetMemoryHeld() const {
+                return m_nMemoryHeld.load(std::memory_order_relaxed);
+            }
+
+            // Return the reservation of a message that has been taken off the incoming queue
+            void ReleaseMemory(const message<T> &msg) {
+                if (m_pMemoryBudget) {
+                    size_t nBytes = FrameCost(msg.header.size);
+                    m_nMemoryHeld.fetch_sub(nBytes, std::memory_order_relaxed);
+                    m_pMemoryBudget->Release(nBytes);
+                }
+            }
+
+#ifdef BSL_NET_TLS
+            // Run this connection over TLS, must be called before ConnectToClient/ConnectToServer. Client connections
+            // pass their session store and the name of the server, so the handshake can resume an earlier session,
+            // and the host they connect to for SNI and hostname verification
+            void EnableTls(asio::ssl::context &ctx, tls_client_context *pSessions = nullptr, std::string sSessionKey = {},
+                           const std::string &sHost = {}) {
+                m_sslStream = std::make_unique<asio::ssl::stream<asio::ip::tcp::socket &>>(m_socket, ctx);
+                m_pTlsSessions = pSessions;
+                m_sTlsSessionKey = std::move(sSessionKey);
+                if (!sHost.empty())
+                    tls_set_host(m_sslStream->native_handle(), sHost);
+            }
+
+            // True if the TLS handshake resumed a previous session instead of doing a full one
+            bool IsSessionResumed() const {
+                return m_sslStream && SSL_session_reused(m_sslStream->native_handle());
+            }
+#endif
+
         public:
             void ConnectToClient(uint32_t uid = 0) {
                 if (m_nOwnerType == owner::server) {
                     if (m_socket.is_open()) {
                         id = uid;
-                        ReadHeader();
+                        // Negotiated before it was admitted, go on where it stopped
+                        if (m_pLink && m_pLink->bAwaitingAdmission) {
+                            asio::post(m_socket.get_executor(), [this, self = this->shared_from_this()]() {
+                                m_pLink->bAwaitingAdmission = false;
+                                if (m_pLink->bStartSession)
+                                    StartSession();
+                                else
+                                    OnEstablished(m_pLink->nHeaderBytesRead);
+                            });
+                            return;
+                        }
+                        if (m_pBusyPoll)
+                            apply_busy_poll(m_socket, *m_pBusyPoll);
+
+                        // The socket runs on its own strand, everything touching the connection state happens there
+                        asio::post(m_socket.get_executor(), [this, self = this->shared_from_this()]() {
+#ifdef BSL_NET_TLS
+                            if (m_sslStream) {
+                                Handshake(asio::ssl::stream_base::server);
+                                return;
+                            }
+#endif
+                            Negotiate();
+                        });
                     }
                 }
             }
 
+            // Negotiate the wire format and the session before the client is admitted, must be called after
+            // SetSessionTable. fnNegotiated is called on the connection's strand once that is done, with whether the
+            // client resumed a session, or once it failed, then the connection is closed. A resumed connection goes
+            // on by itself with the id of its session, any other waits for ConnectToClient to give it one
+            void NegotiateSession(std::function<void(std::shared_ptr<connection<T>>, bool)> fnNegotiated) {
+                m_pLink = std::make_unique<session_link>();
+                m_pLink->fnNegotiated = std::move(fnNegotiated);
+                if (m_pBusyPoll)
+                    apply_busy_poll(m_socket, *m_pBusyPoll);
+
+                asio::post(m_socket.get_executor(), [this, self = this->shared_from_this()]() {
+#ifdef BSL_NET_TLS
+                    if (m_sslStream) {
+                        Handshake(asio::ssl::stream_base::server);
+                        return;
+                    }
+#endif
+                    Negotiate();
+                });
+            }
+
             void ConnectToServer(const asio::ip::tcp::resolver::results_type &endpoints) {
                 // Only clients can connect to servers
                 if (m_nOwnerType == owner::client) {
                     // Request asio attempts to connect to an endpoint
                     asio::async_connect(m_socket, endpoints,
-                                        [this](std::error_code ec, asio::ip::tcp::endpoint endpoint) {
+                                        [this, self = this->shared_from_this()](std::error_code ec,
+                                                                                asio::ip::tcp::endpoint endpoint) {
                                             if (!ec) {
-                                                ReadHeader();
+                                                if (m_pBusyPoll)
+                                                    apply_busy_poll(m_socket, *m_pBusyPoll);
+#ifdef BSL_NET_TLS
+                                                if (m_sslStream) {
+                                                    if (m_pTlsSessions)
+                                                        m_pTlsSessions->Attach(m_sslStream->native_handle(), m_sTlsSessionKey);
+                                                    Handshake(asio::ssl::stream_base::client);
+                                                    return;
+                                                }
+#endif
+                                                Negotiate();
+                                            } else {
+                                                // The socket may be left open, it would look connected forever
+                                                std::cout << "[" << id << "] Connect Fail: " << ec.message() << "\n";
+                                                m_socket.close();
                                             }
                                         });
                 }
             }
 
 
+            // pNext resumed the session of this connection. Close it and pass on what it didn't send, pNext waits
+            // for that before it goes on, so nothing is sent out of order
+            void Supersede(std::shared_ptr<connection<T>> pNext) {
+                // The server doesn't report the client as disconnected, it is still there on pNext
+                m_bSuperseded = true;
+                asio::post(m_socket.get_executor(), [this, self = this->shared_from_this(), pNext = std::move(pNext)]() {
+                    CloseSocket();
+                    // Messages that were on their way here when the connection left the session are queued by now
+                    asio::post(m_socket.get_executor(), [this, self, pNext]() {
+                        asio::post(pNext->m_socket.get_executor(), [pNext, deqUnsent = TakeUnsent()]() mutable {
+                            pNext->AnswerSession(std::move(deqUnsent));
+                        });
+                    });
+                });
+            }
+
+            // Queue messages of the session that a superseded connection didn't send, ahead of newer ones
+            void Requeue(std::deque<std::pair<message<T>, priority>> deqUnsent) {
+                if (m_asioContext.stopped()) return;
+                asio::post(m_socket.get_executor(),
+                           [this, self = this->shared_from_this(), deqUnsent = std::move(deqUnsent)]() mutable {
+                               for (auto it = deqUnsent.rbegin(); it != deqUnsent.rend(); ++it)
+                                   m_qMessagesOut.push_front(std::move(it->first), it->second);
+                               Write();
+                           });
+            }
+
             void Disconnect() {
                 if (IsConnected())
-                    asio::post(m_asioContext, [this]() { m_socket.close(); });
+                    asio::post(m_socket.get_executor(), [this, self = this->shared_from_this()]() {
+                        CloseSocket();
+                        asio::post(m_socket.get_executor(), [this, self]() { DetachSession(); });
+                    });
+            }
+
+            // Close right away and leave what wasn't sent with the session, for the next connection to send. Only
+            // while the connection's context doesn't run
+            void Close() {
+                CloseSocket();
+                DetachSession();
+            }
+
+            // Close the connection and wait until it is done. Afterwards the connection won't deliver anything to
+            // its owner anymore, even though handlers still hold on to it. Must not be called from the context's threads
+            void DisconnectAndWait() {
+                std::promise<void> closed;
+                asio::post(m_socket.get_executor(), [this, &closed]() {
+                    CloseSocket();
+                    asio::post(m_socket.get_executor(), [this, &closed]() {
+                        DetachSession();
+                        closed.set_value();
+                    });
+                });
+                closed.get_future().wait();
             }
 
             bool IsConnected() const {
@@ -71,124 +355,740 @@ namespace bsl {
 
         public:
             // ASYNC - Send a message, connections are one-to-one so no need to specifiy
-            // the target, for a client, the target is the server and vice versa
+            // the target, for a client, the target is the server and vice versa.
+            // The message goes to the lane configured for its id
             void Send(const message <T> &msg) {
-                asio::post(m_asioContext,
-                           [this, msg]() {
-                               bool bWritingMessage = !m_qMessagesOut.empty();
-                               m_qMessagesOut.push_back(msg);
-                               if (!bWritingMessage) {
-                                   WriteHeader();
+                Send(msg, m_pLanePolicy ? m_pLanePolicy->GetPriority(msg.header.id) : priority::normal);
+            }
+
+            // ASYNC - Send a message in a specific lane
+            void Send(const message <T> &msg, priority lane) {
+                trace_mark trace = m_pTracer ? m_pTracer->Sample() : trace_mark{};
+
+                // Once the connection left its session, because it closed or the client resumed the session on
+                // another one, the session sends the message in order with what this one didn't send. Deciding
+                // under the lock keeps messages from arriving here after the connection handed its queue over
+                if (session<T> *pSession = m_pAttached.load()) {
+                    {
+                        std::scoped_lock lock(pSession->SendMutex());
+                        if (!m_bLeftSession) {
+                            Queue(msg, lane, trace);
+                            return;
+                        }
+                    }
+                    if (auto pOwner = pSession->Forward(this, msg, lane))
+                        pOwner->Send(msg, lane);
+                    return;
+                }
+                Queue(msg, lane, trace);
+            }
+
+
+        private:
+            void Queue(const message<T> &msg, priority lane, trace_mark trace) {
+                asio::post(m_socket.get_executor(),
+                           [this, self = this->shared_from_this(), msg, lane, trace]() {
+                               const message<T> &queued = m_qMessagesOut.push_back(msg, lane);
+                               if (trace)
+                                   Trace().vTracedOut.emplace_back(&queued, trace);
+                               // Messages sent before the transport is up are flushed by OnEstablished()
+                               Write();
+                           });
+            }
+
+            // Close the socket and stop taking messages for the session. Only on the strand, messages already on
+            // their way here still arrive, hand them over in a handler posted after this
+            void CloseSocket() {
+                m_socket.close();
+                if (m_pLink && m_pLink->timerAck) m_pLink->timerAck->cancel();
+                if (session<T> *pSession = m_pAttached.load()) {
+                    std::scoped_lock lock(pSession->SendMutex());
+                    m_bLeftSession = true;
+                }
+            }
+
+            // The wire format is agreed, start reading and flush anything queued while connecting. nHeaderBytesRead
+            // are bytes of the first header that were already read during negotiation
+            void OnEstablished(size_t nHeaderBytesRead = 0) {
+                m_bEstablished = true;
+                ReadHeader(nHeaderBytesRead);
+                Write();
+            }
+
+            // The transport is ready, agree on the wire format. A client offering the compact format sends a hello
+            // and waits for the answer. A server accepting it reads the first 8 bytes, a hello is answered, anything
+            // else is the start of a legacy header. Either way nothing is sent to a client before it has spoken
+            void Negotiate() {
+                if (m_wireFormat.load() == wire_format::legacy) {
+                    AwaitAdmission(false);
+                } else if (m_nOwnerType == owner::client) {
+                    m_helloOut.nVersion = uint8_t(m_wireFormat.load());
+                    m_helloOut.nFeatures = m_pSession ? HELLO_FEATURE_SESSION : 0;
+                    AsyncWrite(asio::buffer(&m_helloOut, sizeof(wire_hello)),
+                               [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
+                                   if (!ec) {
+                                       ReadHello();
+                                   } else {
+                                       std::cout << "[" << id << "] Write Hello Fail.\n";
+                                       m_socket.close();
+                                   }
+                               });
+                } else {
+                    // Stop waiting for a hello after a while, the client may wait for the server to speak
+                    m_timerHello = std::make_unique<asio::steady_timer>(m_socket.get_executor(), HELLO_TIMEOUT);
+                    m_timerHello->async_wait([this, self = this->shared_from_this()](std::error_code ec) {
+                        if (ec || !m_timerHello) return;
+                        m_bHelloTimedOut = true;
+                        m_socket.cancel();
+                    });
+                    ReadHello();
+                }
+            }
+
+            void ReadHello() {
+                AsyncRead(asio::buffer(&m_helloIn, sizeof(wire_hello)),
+                          [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
+                              if (m_timerHello) {
+                                  m_timerHello->cancel();
+                                  m_timerHello.reset();
+                              }
+                              if (ec == asio::error::operation_aborted && m_bHelloTimedOut) {
+                                  // No hello in time, a legacy client. What it sent so far starts its first header
+                                  m_wireFormat.store(wire_format::legacy);
+                                  std::memcpy(reinterpret_cast<uint8_t *>(&m_legacyIn), &m_helloIn, length);
+                                  AwaitAdmission(false, length);
+                                  return;
+                              }
+                              if (ec) {
+                                  std::cout << "[" << id << "] Read Hello Fail.\n";
+                                  NegotiationFail();
+                                  return;
+                              }
+
+                              bool bHello = std::memcmp(m_helloIn.magic, m_helloOut.magic, sizeof(m_helloOut.magic)) == 0;
+                              auto nVersion = std::min(m_helloIn.nVersion, uint8_t(m_wireFormat.load()));
+
+                              if (m_nOwnerType == owner::client) {
+                                  if (!bHello) {
+                                      std::cout << "[" << id << "] Negotiation Fail.\n";
+                                      m_socket.close();
+                                      return;
+                                  }
+                                  m_wireFormat.store(wire_format(nVersion));
+                                  if (m_pSession && (m_helloIn.nFeatures & HELLO_FEATURE_SESSION)) {
+                                      ResumeSession();
+                                      return;
+                                  }
+                                  m_pSession.reset();
+                                  OnEstablished();
+                              } else if (bHello) {
+                                  // Answer before anything else is written, the client waits for it. Sessions
+                                  // need the compact header to carry acks
+                                  m_wireFormat.store(wire_format(nVersion));
+                                  m_helloOut.nVersion = nVersion;
+                                  bool bSession = m_pSessions && wire_format(nVersion) == wire_format::compact &&
+                                                  (m_helloIn.nFeatures & HELLO_FEATURE_SESSION);
+                                  m_helloOut.nFeatures = bSession ? HELLO_FEATURE_SESSION : 0;
+                                  AsyncWrite(asio::buffer(&m_helloOut, sizeof(wire_hello)),
+                                             [this, self = this->shared_from_this(), bSession](std::error_code ec, std::size_t length) {
+                                                 if (!ec) {
+                                                     if (bSession)
+                                                         ReadSessionHello();
+                                                     else
+                                                         AwaitAdmission(false);
+                                                 } else {
+                                                     std::cout << "[" << id << "] Write Hello Fail.\n";
+                                                     NegotiationFail();
+                                                 }
+                                             });
+                              } else {
+                                  // A client that doesn't negotiate, these are the first bytes of its first header
+                                  m_wireFormat.store(wire_format::legacy);
+                                  std::memcpy(reinterpret_cast<uint8_t *>(&m_legacyIn), &m_helloIn, sizeof(wire_hello));
+                                  AwaitAdmission(false, sizeof(wire_hello));
+                              }
+                          });
+            }
+
+            // ASYNC - Ask the server to resume the client's session, or for a new one if it has none yet
+            void ResumeSession() {
+                m_pLink = std::make_unique<session_link>();
+                m_pLink->sessionAsked = {m_pSession->Token(), m_pSession->Received()};
+                encode_session_hello(m_pLink->sessionAsked, m_pLink->aSessionHello.data());
+                AsyncWrite(asio::buffer(m_pLink->aSessionHello),
+                           [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
+                               if (!ec) {
+                                   ReadSessionHello();
+                               } else {
+                                   std::cout << "[" << id << "] Write Session Fail.\n";
+                                   m_socket.close();
                                }
                            });
             }
 
+            // ASYNC - Read the session the client asks for, or the server's answer to that
+            void ReadSessionHello() {
+                if (!m_pLink)
+                    m_pLink = std::make_unique<session_link>();
+                AsyncRead(asio::buffer(m_pLink->aSessionHello),
+                          [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
+                              if (ec) {
+                                  std::cout << "[" << id << "] Read Session Fail.\n";
+                                  NegotiationFail();
+                                  return;
+                              }
 
-        private:
-            // ASYNC - Prime context to write a message header
-            void WriteHeader() {
-                asio::async_write(m_socket, asio::buffer(&m_qMessagesOut.front().header, sizeof(message_header<T>)),
-                                  [this](std::error_code ec, std::size_t length) {
-                                      if (!ec) {
-                                          // Check if the message also have a message body
-                                          if (m_qMessagesOut.front().body.size() > 0) {
-                                              // If it is, then write the body too.
-                                              WriteBody();
-                                          } else {
-                                              // It didnt, so we are done with this message. Remove it from th out message queue
-                                              m_qMessagesOut.pop_front();
-
-                                              // If the queue is not empty, there are more messages to send
-                                              if (!m_qMessagesOut.empty()) {
-                                                  WriteHeader();
-                                              }
-                                          }
-                                      } else {
-                                          std::cout << "[" << id << "] Write Header Fail.\n";
-                                          m_socket.close();
-                                      }
-                                  });
-            }
-
-            // ASYNC - Prime context to write a message body
-            void WriteBody() {
-                // If this function is called, a header has just been sent
-                asio::async_write(m_socket,
-                                  asio::buffer(m_qMessagesOut.front().body.data(), m_qMessagesOut.front().body.size()),
-                                  [this](std::error_code ec, std::size_t length) {
-                                      if (!ec) {
-                                          // Sending was successful, so we are done with the message
-                                          m_qMessagesOut.pop_front();
-
-                                          // If the queue is not empty, there are more messages to send
-                                          if (!m_qMessagesOut.empty()) {
-                                              WriteHeader();
-                                          }
-                                      } else {
-                                          std::cout << "[" << id << "] Write Body Fail.\n";
-                                          m_socket.close();
-                                      }
-                                  });
+                              session_hello hello = decode_session_hello(m_pLink->aSessionHello.data());
+                              if (m_nOwnerType == owner::client)
+                                  OnSessionAnswer(hello);
+                              else
+                                  OnSessionRequest(hello);
+                          });
+            }
+
+            // Resume the session the client asks for if it is known and has kept everything the client is missing,
+            // otherwise start a new one once the client is admitted. Then tell the client which it is
+            void OnSessionRequest(const session_hello &hello) {
+                typename session<T>::handover resumed;
+                auto pSession = hello.nToken ? m_pSessions->Find(hello.nToken) : nullptr;
+                if (!pSession || !pSession->Attach(this->shared_from_this(), hello.nReceived, resumed)) {
+                    AwaitAdmission(true);
+                    return;
+                }
+
+                // The client was admitted with its session, the connection goes on with its id before the owner
+                // learns about it
+                id = pSession->Id();
+                m_bResumed = true;
+                AttachSession(std::move(pSession), hello.nReceived, resumed);
+                Negotiated(true);
+                // The connection the client had may not have noticed yet that it is gone, it still holds
+                // messages the app sent to it
+                if (resumed.pPrevious) {
+                    resumed.pPrevious->Supersede(this->shared_from_this());
+                    return;
+                }
+                AnswerSession({});
+            }
+
+            void StartSession() {
+                typename session<T>::handover created;
+                auto pSession = m_pSessions->Create(id);
+                pSession->Attach(this->shared_from_this(), 0, created);
+                AttachSession(std::move(pSession), 0, created);
+                AnswerSession({});
+            }
+
+            // Negotiation is done, a server that negotiates before it admits the client is told and the connection
+            // waits for ConnectToClient. Then it starts a new session if bStartSession, or starts reading
+            void AwaitAdmission(bool bStartSession, size_t nHeaderBytesRead = 0) {
+                if (!m_pLink || !m_pLink->fnNegotiated) {
+                    if (bStartSession)
+                        StartSession();
+                    else
+                        OnEstablished(nHeaderBytesRead);
+                    return;
+                }
+                m_pLink->bAwaitingAdmission = true;
+                m_pLink->bStartSession = bStartSession;
+                m_pLink->nHeaderBytesRead = nHeaderBytesRead;
+                Negotiated(false);
             }
 
-            // ASYNC - Prime context ready to read a message header
-            void ReadHeader() {
+            // Tell a server waiting for the negotiation that it is done, or failed if the socket is closed
+            void Negotiated(bool bResumed) {
+                if (!m_pLink || !m_pLink->fnNegotiated) return;
+                auto fnNegotiated = std::move(m_pLink->fnNegotiated);
+                m_pLink->fnNegotiated = nullptr;
+                fnNegotiated(this->shared_from_this(), bResumed);
+            }
+
+            void NegotiationFail() {
+                m_socket.close();
+                Negotiated(false);
+            }
+
+            // Tell the client which session the connection continues. deqUnsent are messages the previous
+            // connection of the session didn't send, they go before anything queued here
+            void AnswerSession(std::deque<std::pair<message<T>, priority>> deqUnsent) {
+                for (auto it = deqUnsent.rbegin(); it != deqUnsent.rend(); ++it)
+                    m_qMessagesOut.push_front(std::move(it->first), it->second);
+
+                encode_session_hello({m_pSession->Token(), m_pLink->nReceived}, m_pLink->aSessionHello.data());
+                AsyncWrite(asio::buffer(m_pLink->aSessionHello),
+                           [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
+                               if (!ec) {
+                                   OnEstablished();
+                               } else {
+                                   std::cout << "[" << id << "] Write Session Fail.\n";
+                                   m_socket.close();
+                               }
+                           });
+            }
+
+            // The server resumed the session if it answered with the token asked for, otherwise everything of
+            // the old session is gone and a new one starts
+            void OnSessionAnswer(const session_hello &hello) {
+                bool bResumed = hello.nToken == m_pLink->sessionAsked.nToken && hello.nToken != 0;
+                if (!bResumed)
+                    m_pSession->Reset(hello.nToken);
+
+                typename session<T>::handover resumed;
+                if (!m_pSession->Attach(this->shared_from_this(), hello.nReceived, resumed)) {
+                    std::cout << "[" << id << "] Session Resume Fail.\n";
+                    m_socket.close();
+                    return;
+                }
+                m_bResumed = bResumed;
+                AttachSession(m_pSession, hello.nReceived, resumed);
+                OnEstablished();
+            }
+
+            // Take over the session, what the remote is missing is sent before anything queued on this connection
+            void AttachSession(std::shared_ptr<session<T>> pSession, uint64_t nRemoteReceived,
+                               typename session<T>::handover &resumed) {
+                m_pSession = std::move(pSession);
+                m_pAttached = m_pSession.get();
+                m_pLink->nReceived = m_pLink->nAckSent = resumed.nReceived;
+                m_pLink->nRemoteReceived = nRemoteReceived;
+                m_pLink->deqReplay = std::move(resumed.deqReplay);
+                for (auto it = resumed.deqUnsent.rbegin(); it != resumed.deqUnsent.rend(); ++it)
+                    m_qMessagesOut.push_front(std::move(it->first), it->second);
+            }
+
+            // Leave what wasn't sent with the session. Only on the strand, or once nothing runs there anymore
+            void DetachSession() {
+                if (m_pSession)
+                    m_pSession->Detach(this, TakeUnsent());
+            }
+
+            std::deque<std::pair<message<T>, priority>> TakeUnsent() {
+                if (m_pTrace)
+                    m_pTrace->vTracedOut.clear();
+                std::deque<std::pair<message<T>, priority>> deqUnsent;
+                m_qMessagesOut.drain([&deqUnsent](message<T> &&msg, priority lane) {
+                    deqUnsent.emplace_back(std::move(msg), lane);
+                });
+                return deqUnsent;
+            }
+
+#ifdef BSL_NET_TLS
+            // ASYNC - Perform the TLS handshake, it runs on the context like any other read or write so the
+            // accept loop is never held up by it
+            void Handshake(asio::ssl::stream_base::handshake_type type) {
+                m_sslStream->async_handshake(type,
+                                             [this, self = this->shared_from_this()](std::error_code ec) {
+                                                 if (!ec) {
+                                                     Negotiate();
+                                                 } else {
+                                                     std::cout << "[" << id << "] TLS Handshake Fail: " << ec.message() << "\n";
+                                                     // Don't offer a session the server just refused again
+                                                     if (m_pTlsSessions)
+                                                         m_pTlsSessions->Forget(m_sTlsSessionKey);
+                                                     NegotiationFail();
+                                                 }
+                                             });
+            }
+#endif
+
+            // Reads and writes go through the TLS stream when there is one, the framing on top is the same
+            template<typename MutableBuffer, typename Handler>
+            void AsyncRead(const MutableBuffer &buffer, Handler &&handler) {
+#ifdef BSL_NET_TLS
+                if (m_sslStream) {
+                    asio::async_read(*m_sslStream, buffer, std::forward<Handler>(handler));
+                    return;
+                }
+#endif
+                asio::async_read(m_socket, buffer, std::forward<Handler>(handler));
+            }
+
+            template<typename MutableBuffer, typename CompletionCondition, typename Handler>
+            void AsyncRead(const MutableBuffer &buffer, CompletionCondition &&condition, Handler &&handler) {
+#ifdef BSL_NET_TLS
+                if (m_sslStream) {
+                    asio::async_read(*m_sslStream, buffer, std::forward<CompletionCondition>(condition),
+                                     std::forward<Handler>(handler));
+                    return;
+                }
+#endif
+                asio::async_read(m_socket, buffer, std::forward<CompletionCondition>(condition),
+                                 std::forward<Handler>(handler));
+            }
+
+            template<typename ConstBuffer, typename Handler>
+            void AsyncWrite(const ConstBuffer &buffer, Handler &&handler) {
+#ifdef BSL_NET_TLS
+                if (m_sslStream) {
+                    asio::async_write(*m_sslStream, buffer, std::forward<Handler>(handler));
+                    return;
+                }
+#endif
+                asio::async_write(m_socket, buffer, std::forward<Handler>(handler));
+            }
+
+            // Put the header in its wire format into m_aHeaderOut, returns its length. In a session every frame
+            // acknowledges what arrived since the previous one, pHeader is null for a frame that only does that
+            size_t EncodeHeader(const message_header<T> *pHeader) {
+                if (m_pSession) {
+                    uint64_t nAck = m_pLink->nReceived - m_pLink->nAckSent;
+                    m_pLink->nAckSent = m_pLink->nReceived;
+                    m_pLink->bAckDue = false;
+                    return encode_session_header(pHeader, nAck, m_aHeaderOut.data());
+                }
+
+                if (m_wireFormat.load(std::memory_order_relaxed) == wire_format::compact)
+                    return encode_compact_header(*pHeader, m_aHeaderOut.data());
+
+                legacy_header<T> legacy;
+                legacy.id = pHeader->id;
+                legacy.size = pHeader->size;
+                std::memcpy(m_aHeaderOut.data(), &legacy, sizeof(legacy));
+                return sizeof(legacy);
+            }
+
+            // ASYNC - Write the next frame unless one is being written. Messages the remote missed when a session
+            // was resumed go first, then the lanes, and when neither has anything but an ack is due, a frame that
+            // only carries the ack. Header and body go out in a single write
+            void Write() {
+                if (m_bWriting || !m_bEstablished) return;
+
+                bool bMessage = true;
+                if (m_pTrace)
+                    m_pTrace->traceOut = {};
+                if (m_pLink && !m_pLink->deqReplay.empty()) {
+                    m_msgOut = std::move(m_pLink->deqReplay.front());
+                    m_pLink->deqReplay.pop_front();
+                } else if (!m_qMessagesOut.empty()) {
+                    // A superseded connection leaves its queue to the one that resumed the session, it hands it
+                    // over once it is closed
+                    if (m_pSession && !m_pSession->Sent(this, m_qMessagesOut.front()))
+                        return;
+                    if (m_pTrace && !m_pTrace->vTracedOut.empty())
+                        TraceDequeued(m_qMessagesOut.front());
+                    m_msgOut = std::move(m_qMessagesOut.front());
+                    m_qMessagesOut.pop_front();
+                } else if (m_pLink && m_pLink->bAckDue && m_pLink->nReceived != m_pLink->nAckSent) {
+                    bMessage = false;
+                } else {
+                    return;
+                }
+
+                m_bWriting = true;
+                std::array<asio::const_buffer, 2> buffers = {
+                        asio::buffer(m_aHeaderOut.data(), EncodeHeader(bMessage ? &m_msgOut.header : nullptr)),
+                        asio::buffer(m_msgOut.body.data(), bMessage ? m_msgOut.body.size() : 0)
+                };
+                AsyncWrite(buffers,
+                           [this, self = this->shared_from_this(), bMessage](std::error_code ec, std::size_t length) {
+                               if (!ec) {
+                                   // Sending was successful, so we are done with the message
+                                   m_bWriting = false;
+                                   if (m_pTrace && m_pTrace->traceOut)
+                                       m_pTracer->Record(trace_stage::write, id, m_pTrace->traceOut);
+                                   if (bMessage) {
+                                       CaptureFrame(capture_direction::outbound, m_msgOut);
+                                       m_msgOut = message<T>();
+                                   }
+
+                                   // If the queue is not empty, there are more messages to send
+                                   Write();
+                               } else {
+                                   std::cout << "[" << id << "] Write Message Fail.\n";
+                                   m_socket.close();
+                               }
+                           });
+            }
+
+            // ASYNC - Prime context ready to read a message header, nAlreadyRead bytes of it may have been read before
+            void ReadHeader(size_t nAlreadyRead = 0) {
                 // Because this function is asynchronized, so we need a temporary message to get full of the message
-                asio::async_read(m_socket, asio::buffer(&m_msgTemporaryIn.header, sizeof(message_header<T>)),
-                                 [this](std::error_code ec, std::size_t length) {
-                                     if (!ec) {
-                                         // A complete message header has been read, check if this message has a body
-                                         if (m_msgTemporaryIn.header.size > 0) {
-                                             // If it does, so allocate enough space in the messages' body, and tell asio context to read body
-                                             m_msgTemporaryIn.body.resize(m_msgTemporaryIn.header.size);
-                                             ReadBody();
-                                         } else {
-                                             // If it doesn't, so add this message to incoming queue
-                                             AddToIncomingMessageQueue();
-                                         }
-                                     } else {
-                                         std::cout << "[" << id << "] Read Header Fail.\n";
-                                         m_socket.close();
-                                     }
-                                 });
+                if (m_wireFormat.load(std::memory_order_relaxed) == wire_format::compact) {
+                    // The header length isn't known up front, only ask for the bytes it needs at least so nothing
+                    // past its end is read
+                    AsyncRead(asio::buffer(m_aHeaderIn),
+                              [this](std::error_code ec, std::size_t length) -> std::size_t {
+                                  size_t nMissing = 0;
+                                  if (ec || DecodeHeader(length, nMissing) != 0)
+                                      return 0;
+                                  return nMissing;
+                              },
+                              [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
+                                  size_t nMissing = 0;
+                                  if (ec) {
+                                      std::cout << "[" << id << "] Read Header Fail.\n";
+                                      m_socket.close();
+                                  } else if (DecodeHeader(length, nMissing) <= 0) {
+                                      std::cout << "[" << id << "] Malformed Header.\n";
+                                      m_socket.close();
+                                  } else if (!m_pSession) {
+                                      OnHeader();
+                                  } else {
+                                      if (m_pLink->nAckIn) {
+                                          m_pLink->nRemoteReceived += m_pLink->nAckIn;
+                                          m_pSession->Acked(this, m_pLink->nRemoteReceived);
+                                      }
+                                      if (m_pLink->bFrameIsMessage)
+                                          OnHeader();
+                                      else
+                                          ReadHeader();
+                                  }
+                              });
+                    return;
+                }
+
+                AsyncRead(asio::buffer(reinterpret_cast<uint8_t *>(&m_legacyIn) + nAlreadyRead,
+                                       sizeof(legacy_header<T>) - nAlreadyRead),
+                          [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
+                              if (!ec) {
+                                  m_msgTemporaryIn.header.id = m_legacyIn.id;
+                                  m_msgTemporaryIn.header.size = m_legacyIn.size;
+                                  m_msgTemporaryIn.header.flags = 0;
+                                  OnHeader();
+                              } else {
+                                  std::cout << "[" << id << "] Read Header Fail.\n";
+                                  m_socket.close();
+                              }
+                          });
+            }
+
+            // Parse the compact or session header from the first nLength bytes of m_aHeaderIn
+            int DecodeHeader(size_t nLength, size_t &nMissing) {
+                if (m_pSession)
+                    return decode_session_header(m_aHeaderIn.data(), nLength, m_msgTemporaryIn.header, m_pLink->nAckIn,
+                                                 m_pLink->bFrameIsMessage, nMissing);
+                return decode_compact_header(m_aHeaderIn.data(), nLength, m_msgTemporaryIn.header, nMissing);
+            }
+
+            // The outbound queue stage of a traced message ends when it is taken off the lanes, its write begins
+            void TraceDequeued(const message<T> &msg) {
+                auto &vTracedOut = m_pTrace->vTracedOut;
+                for (auto it = vTracedOut.begin(); it != vTracedOut.end(); ++it) {
+                    if (it->first == &msg) {
+                        m_pTrace->traceOut = it->second;
+                        m_pTracer->Record(trace_stage::outbound_queue, id, m_pTrace->traceOut);
+                        vTracedOut.erase(it);
+                        return;
+                    }
+                }
+            }
+
+            // The trace marks of the connection, allocated with its first traced message
+            trace_state &Trace() {
+                if (!m_pTrace)
+                    m_pTrace = std::make_unique<trace_state>();
+                return *m_pTrace;
+            }
+
+            // A complete message header has been read
+            void OnHeader() {
+                trace_mark traceIn = m_pTracer ? m_pTracer->Sample() : trace_mark{};
+                if (traceIn || m_pTrace)
+                    Trace().traceIn = traceIn;
+
+                // Never trust the size announced by the remote, refuse frames over the limit before allocating anything.
+                // Without limits attached any size is accepted
+                if (m_pFrameLimits && m_msgTemporaryIn.header.size > m_pFrameLimits->Get(m_msgTemporaryIn.header.id)) {
+                    std::cout << "[" << id << "] Frame Too Large: " << m_msgTemporaryIn.header.size << "\n";
+                    m_socket.close();
+                    return;
+                }
+
+                ThrottleFrame();
+            }
+
+            // Charge the frame to the rate limits. When they are used up no further read is issued until they have
+            // refilled, so like with the memory budget the remote is held back by TCP flow control
+            void ThrottleFrame() {
+                if (m_pRateLimits) {
+                    if (!m_pRate)
+                        m_pRate = std::make_unique<connection_rate<T>>();
+                    auto wait = m_pRate->Charge(*m_pRateLimits, m_msgTemporaryIn.header.id, m_msgTemporaryIn.header.size);
+                    if (wait > token_bucket::clock::duration::zero()) {
+                        m_nThrottled.fetch_add(1, std::memory_order_relaxed);
+                        if (!m_timerThrottle)
+                            m_timerThrottle = std::make_unique<asio::steady_timer>(m_socket.get_executor());
+                        m_timerThrottle->expires_after(wait);
+                        m_timerThrottle->async_wait([this, self = this->shared_from_this()](std::error_code ec) {
+                            if (!ec && IsConnected())
+                                ThrottleFrame();
+                        });
+                        return;
+                    }
+                }
+
+                ReserveFrame();
+            }
+
+            // Reserve memory for the message whose header was just read, then carry on reading it. If the budget is
+            // exhausted no further read is issued, so the remote is held back by TCP flow control until memory is released
+            void ReserveFrame() {
+                if (m_pMemoryBudget) {
+                    size_t nBytes = FrameCost(m_msgTemporaryIn.header.size);
+                    if (!m_pMemoryBudget->TryAcquire(nBytes)) {
+                        m_pMemoryBudget->Wait(nBytes, [self = this->shared_from_this()]() {
+                            asio::post(self->m_socket.get_executor(), [self]() {
+                                if (self->IsConnected())
+                                    self->ReserveFrame();
+                            });
+                        });
+                        return;
+                    }
+                    m_nMemoryHeld.fetch_add(nBytes, std::memory_order_relaxed);
+                }
+
+                // A complete message header has been read, check if this message has a body
+                if (m_msgTemporaryIn.header.size > 0) {
+                    // If it does, so allocate enough space in the messages' body, and tell asio context to read body
+                    m_msgTemporaryIn.body.resize(m_msgTemporaryIn.header.size);
+                    ReadBody();
+                } else {
+                    // If it doesn't, so add this message to incoming queue
+                    AddToIncomingMessageQueue();
+                }
+            }
+
+            // Bytes a frame is charged against the memory budget
+            static size_t FrameCost(uint32_t nBodySize) {
+                return sizeof(owned_message<T>) + nBodySize;
             }
 
             // ASYNC - Prime context ready to read a message body
             void ReadBody() {
                 // If this function is called, a header has already been read, and allocate enough space to store the body
-                asio::async_read(m_socket, asio::buffer(m_msgTemporaryIn.body.data(), m_msgTemporaryIn.body.size()),
-                                 [this](std::error_code ec, std::size_t length) {
-                                     if (!ec) {
-                                         // The message is complete now, just add it to the incoming message queue
-                                         AddToIncomingMessageQueue();
-                                     } else {
-                                         std::cout << "[" << id << "] Read Body Fail.\n";
-                                         m_socket.close();
-                                     }
-                                 });
+                AsyncRead(asio::buffer(m_msgTemporaryIn.body.data(), m_msgTemporaryIn.body.size()),
+                          [this, self = this->shared_from_this()](std::error_code ec, std::size_t length) {
+                              if (!ec) {
+                                  // The message is complete now, just add it to the incoming message queue
+                                  AddToIncomingMessageQueue();
+                              } else {
+                                  std::cout << "[" << id << "] Read Body Fail.\n";
+                                  // The partial message never reaches the queue, so give its reservation back here
+                                  ReleaseMemory(m_msgTemporaryIn);
+                                  m_socket.close();
+                              }
+                          });
+            }
+
+            void CaptureFrame(capture_direction direction, const message<T> &msg) {
+                if (m_pCapture && m_pCapture->IsOpen() && m_socket.is_open()) {
+                    capture_message_header header = capture_encode_header(msg.header);
+                    m_pCapture->Record(id, direction, &header, sizeof(header), msg.body.data(), msg.body.size());
+                }
             }
 
             // When a full message is arrived, call this function
             void AddToIncomingMessageQueue() {
-                // Push the temporary message to the message queue and add owner information to the message
+                // A read that completed just before the socket was closed must not reach an owner that may be gone
+                if (!m_socket.is_open()) {
+                    ReleaseMemory(m_msgTemporaryIn);
+                    return;
+                }
+
+                if (m_pSession) {
+                    // A superseded connection drops what still arrives, the remote sends it again to the new one
+                    uint64_t nReceived = m_pSession->Received(this);
+                    if (nReceived == 0) {
+                        ReleaseMemory(m_msgTemporaryIn);
+                        return;
+                    }
+                    m_pLink->nReceived = nReceived;
+                    ScheduleAck();
+                }
+
+                CaptureFrame(capture_direction::inbound, m_msgTemporaryIn);
+                trace_mark traceIn = m_pTrace ? m_pTrace->traceIn : trace_mark{};
+                if (traceIn)
+                    m_pTracer->Record(trace_stage::read, id, traceIn);
+
+                // Move the temporary message to the message queue and add owner information to the message. Its body
+                // goes along, so an idle connection holds no receive buffer, the next body is allocated when it arrives
                 if (m_nOwnerType == owner::server)
-                    m_qMessagesIn.push_back({this->shared_from_this(), m_msgTemporaryIn});
+                    m_qMessagesIn.push_back({this->shared_from_this(), std::move(m_msgTemporaryIn), traceIn});
                 else
-                    m_qMessagesIn.push_back({nullptr, m_msgTemporaryIn});
+                    m_qMessagesIn.push_back({nullptr, std::move(m_msgTemporaryIn), traceIn});
 
                 // Prime the asio context to read another header
                 ReadHeader();
             }
 
+            // Acks normally go along with the next message. Without one, acknowledge once SESSION_ACK_BATCH messages
+            // are waiting for it or SESSION_ACK_DELAY has passed, so the remote can free its replay buffer
+            void ScheduleAck() {
+                session_link &link = *m_pLink;
+                if (link.nReceived - link.nAckSent >= SESSION_ACK_BATCH) {
+                    link.bAckDue = true;
+                    Write();
+                    return;
+                }
+                if (link.bAckTimerArmed) return;
+
+                if (!link.timerAck)
+                    link.timerAck = std::make_unique<asio::steady_timer>(m_socket.get_executor());
+                link.bAckTimerArmed = true;
+                link.timerAck->expires_after(SESSION_ACK_DELAY);
+                link.timerAck->async_wait([this, self = this->shared_from_this()](std::error_code ec) {
+                    m_pLink->bAckTimerArmed = false;
+                    if (!ec && IsConnected() && m_pLink->nReceived != m_pLink->nAckSent) {
+                        m_pLink->bAckDue = true;
+                        Write();
+                    }
+                });
+            }
+
         protected:
-            // Each connection has a unique socket to a remote
+            // What the owner shares with the connection, declared first so everything else is gone before it
+            std::shared_ptr<void> m_pOwnerState;
+
+            // Each connection has a unique socket to a remote. It is created on a strand, so all handlers of
+            // this connection are serialized even when the context runs on several threads
             asio::ip::tcp::socket m_socket;
 
+#ifdef BSL_NET_TLS
+            // Optional TLS layer on top of m_socket, and where client connections keep their resumable sessions
+            std::unique_ptr<asio::ssl::stream<asio::ip::tcp::socket &>> m_sslStream;
+            tls_client_context *m_pTlsSessions = nullptr;
+            std::string m_sTlsSessionKey;
+#endif
+
+            // Set once connected and, with TLS, after the handshake. Only touched on the context thread
+            bool m_bEstablished = false;
+
+            // The offered wire format until negotiation is done, the agreed one afterwards
+            std::atomic<wire_format> m_wireFormat{wire_format::legacy};
+            wire_hello m_helloIn, m_helloOut;
+            std::unique_ptr<asio::steady_timer> m_timerHello;
+            bool m_bHelloTimedOut = false;
+
+            // Wire headers being read and written
+            static_assert(sizeof(legacy_header<T>) >= sizeof(wire_hello), "A legacy header starts where a hello would");
+            legacy_header<T> m_legacyIn;
+            std::array<uint8_t, SESSION_HEADER_MAX> m_aHeaderIn{};
+            std::array<uint8_t, std::max(SESSION_HEADER_MAX, sizeof(legacy_header<T>))> m_aHeaderOut{};
+
+            // The message being written, and whether a write is in progress
+            message<T> m_msgOut;
+            bool m_bWriting = false;
+
+            // Session of the connection once agreed, and the table servers resume sessions from
+            std::shared_ptr<session<T>> m_pSession;
+            session_table<T> *m_pSessions = nullptr;
+            std::atomic<bool> m_bResumed{false};
+            std::atomic<bool> m_bSuperseded{false};
+            // The session once attached, for Send() on other threads, and whether the connection left it. That is
+            // only changed and read under the session's send lock
+            std::atomic<session<T> *> m_pAttached{nullptr};
+            bool m_bLeftSession = false;
+
+            // What only a connection negotiating or in a session needs, allocated when negotiation starts
+            std::unique_ptr<session_link> m_pLink;
+
             // This context is shared with the whole asio instance
             asio::io_context &m_asioContext;
 
-            // This queue holds all messages to be sent to the remote side
-            tsqueue <message<T>> m_qMessagesOut;
+            // This queue holds all messages to be sent to the remote side, split in priority lanes
+            outbound_lanes<T> m_qMessagesOut;
+            const lane_policy<T> *m_pLanePolicy = nullptr;
 
             // This references the incoming queue
             tsqueue <owned_message<T>> &m_qMessagesIn;
@@ -199,7 +1099,33 @@ namespace bsl {
             // The owner of the connetion
             owner m_nOwnerType = owner::server;
 
-            uint32_t id = 0;
+            // A resumed session's id, or the one given when the client is admitted. It doesn't change once the owner
+            // has seen the connection
+            std::atomic<uint32_t> id{0};
+
+            // Server wide limits on inbound memory, both are null for client side connections
+            memory_budget *m_pMemoryBudget = nullptr;
+            const frame_limits<T> *m_pFrameLimits = nullptr;
+
+            // Server wide inbound rate limits, this connection's buckets and the timer resuming reads once they refilled
+            const rate_limits<T> *m_pRateLimits = nullptr;
+            std::unique_ptr<connection_rate<T>> m_pRate;
+            std::unique_ptr<asio::steady_timer> m_timerThrottle;
+            std::atomic<size_t> m_nThrottled{0};
+
+            // Traffic capture of the owner, recording only happens while it is open
+            capture_writer *m_pCapture = nullptr;
+
+            // Tracer of the owner, and the marks of the traced messages being read, queued and written, allocated
+            // with the first sampled message, most connections never carry one
+            tracer *m_pTracer = nullptr;
+            std::unique_ptr<trace_state> m_pTrace;
+
+            // Low latency mode of the owner, if it is enabled
+            const busy_poll *m_pBusyPoll = nullptr;
+
+            // Bytes reserved by this connection which haven't been released yet
+            std::atomic<size_t> m_nMemoryHeld{0};
 
         };
     }
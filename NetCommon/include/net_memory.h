@@ -0,0 +1,128 @@
+#pragma once
+
+#include "net_common.h"
+
+namespace bsl {
+    namespace net {
+        // Largest body a single frame may carry unless a limit is configured for its id
+        constexpr uint32_t DEFAULT_MAX_FRAME_SIZE = 16 * 1024 * 1024;
+
+        // Bytes a server may hold in receive buffers and the inbound queue together
+        constexpr size_t DEFAULT_MEMORY_BUDGET = 256 * 1024 * 1024;
+
+        // Per message id limits on the body size a peer is allowed to announce in a header
+        template<typename T>
+        class frame_limits {
+        public:
+            // Limit applied to every id without its own entry
+            void SetDefault(uint32_t nMaxSize) {
+                m_nDefaultMaxSize = nMaxSize;
+            }
+
+            void Set(T id, uint32_t nMaxSize) {
+                m_mapMaxSize[id] = nMaxSize;
+            }
+
+            uint32_t Get(T id) const {
+                auto it = m_mapMaxSize.find(id);
+                return it != m_mapMaxSize.end() ? it->second : m_nDefaultMaxSize;
+            }
+
+        private:
+            uint32_t m_nDefaultMaxSize = DEFAULT_MAX_FRAME_SIZE;
+            std::unordered_map<T, uint32_t> m_mapMaxSize;
+        };
+
+        // Byte budget shared by all connections of a server. Connections reserve the space of a frame before
+        // allocating its body, and the reservation is returned once the message has left the inbound queue.
+        // A connection that can't reserve parks itself here, and stops reading until its frame fits.
+        class memory_budget {
+        public:
+            explicit memory_budget(size_t nLimit = DEFAULT_MEMORY_BUDGET) : m_nLimit(nLimit) {}
+
+            memory_budget(const memory_budget &) = delete;
+
+        public:
+            // May be changed while connections are reading
+            void SetLimit(size_t nLimit) {
+                m_nLimit.store(nLimit, std::memory_order_relaxed);
+                // A bigger limit may let parked readers continue
+                WakeWaiters();
+            }
+
+            size_t Limit() const {
+                return m_nLimit.load(std::memory_order_relaxed);
+            }
+
+            size_t Used() const {
+                return m_nUsed.load(std::memory_order_relaxed);
+            }
+
+            // Reserve nBytes, returns false if that would overrun the limit
+            bool TryAcquire(size_t nBytes) {
+                size_t nUsed = m_nUsed.load(std::memory_order_relaxed);
+                do {
+                    if (!Fits(nUsed, nBytes))
+                        return false;
+                } while (!m_nUsed.compare_exchange_weak(nUsed, nUsed + nBytes, std::memory_order_relaxed));
+                return true;
+            }
+
+            // Return a reservation, and resume readers that were waiting for memory
+            void Release(size_t nBytes) {
+                m_nUsed.fetch_sub(nBytes, std::memory_order_relaxed);
+                WakeWaiters();
+            }
+
+            // Park a reader until nBytes fit in the budget. The waiter is called once and has to try again itself,
+            // another reader may have taken the memory first
+            void Wait(size_t nBytes, std::function<void()> fnResume) {
+                {
+                    std::scoped_lock lock(m_muxWaiters);
+                    m_deqWaiters.push_back({nBytes, std::move(fnResume)});
+                }
+
+                // Memory may have been released between the failed acquire and parking
+                WakeWaiters();
+            }
+
+        private:
+            struct waiter {
+                size_t nBytes;
+                std::function<void()> fnResume;
+            };
+
+            bool Fits(size_t nUsed, size_t nBytes) const {
+                // A single frame bigger than the whole budget is still let through when nothing else is held,
+                // otherwise it could never be read at all
+                return nUsed == 0 || nUsed + nBytes <= Limit();
+            }
+
+            // Resume the waiters whose frame fits now, the others stay parked
+            void WakeWaiters() {
+                std::vector<std::function<void()>> vResume;
+                {
+                    std::scoped_lock lock(m_muxWaiters);
+                    for (auto it = m_deqWaiters.begin(); it != m_deqWaiters.end();) {
+                        if (Fits(Used(), it->nBytes)) {
+                            vResume.push_back(std::move(it->fnResume));
+                            it = m_deqWaiters.erase(it);
+                        } else {
+                            ++it;
+                        }
+                    }
+                }
+
+                for (auto &fnResume : vResume)
+                    fnResume();
+            }
+
+        private:
+            std::atomic<size_t> m_nLimit;
+            std::atomic<size_t> m_nUsed{0};
+
+            std::mutex m_muxWaiters;
+            std::deque<waiter> m_deqWaiters;
+        };
+    }
+}
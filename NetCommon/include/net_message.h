@@ -1,14 +1,17 @@
 #pragma once
 
 #include "net_common.h"
+#include "net_trace.h"
 
 namespace bsl {
     namespace net {
-        // Message Header is sent at start of all messages. It has fixed size
+        // Message Header is sent at start of all messages. How it looks on the wire depends on the wire_format
         template<typename T>
         struct message_header {
             T id{};
             uint32_t size = 0;
+            // Free for the application, only carried by the compact wire format
+            uint8_t flags = 0;
         };
 
         // Message Body contains a header and a std::vector, containing raw bytes of infomation.
@@ -85,6 +88,8 @@ namespace bsl {
         struct owned_message {
             std::shared_ptr<connection<T>> remote = nullptr;
             message<T> msg;
+            // Set if the message is traced, its inbound queue stage began when it was queued
+            trace_mark trace;
 
             friend std::ostream &operator<<(std::ostream &os, const owned_message<T> &msg) {
                 os << msg.msg;
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "net_common.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+namespace bsl {
+    namespace net {
+        // Opt in low latency mode. Threads that would sleep in the kernel until there is work, the io threads in
+        // epoll and the consumer of the incoming queue on its condition variable, first keep checking for up to
+        // spin, so work arriving soon after the last is picked up without a wakeup. Sockets get TCP_NODELAY, and
+        // SO_BUSY_POLL of nSocketMicros so reads poll the device queue instead of waiting for its interrupt, raising
+        // it above net.core.busy_read may need CAP_NET_ADMIN. Spinning threads burn their core while they spin, the
+        // mode pays off with a core for each of them
+        struct busy_poll {
+            std::chrono::microseconds spin{0};
+            int nSocketMicros = 50;
+
+            bool Enabled() const {
+                return spin.count() > 0;
+            }
+        };
+
+        // One turn of a spin loop. The pause lets the other hyperthread run, the yield lets threads waiting for
+        // this core run, so with fewer cores than spinning threads the one that has work still gets to do it
+        inline void spin_pause() {
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+            _mm_pause();
+#elif defined(__aarch64__)
+            asm volatile("yield");
+#endif
+            std::this_thread::yield();
+        }
+
+        // Set the socket options of the mode on a connected socket. Returns false if one of them failed, the
+        // connection works either way
+        inline bool apply_busy_poll(asio::ip::tcp::socket &socket, const busy_poll &poll) {
+            if (!poll.Enabled()) return true;
+
+            std::error_code ec;
+            socket.set_option(asio::ip::tcp::no_delay(true), ec);
+            bool bApplied = !ec;
+#ifdef SO_BUSY_POLL
+            int nMicros = poll.nSocketMicros;
+            if (nMicros > 0)
+                bApplied = ::setsockopt(socket.native_handle(), SOL_SOCKET, SO_BUSY_POLL, &nMicros, sizeof(nMicros)) == 0 &&
+                           bApplied;
+#endif
+            return bApplied;
+        }
+
+        // Run the context until it is stopped or out of work, like io_context::run(). With the mode enabled it
+        // runs ready handlers with poll(), which checks the sockets without sleeping, and only blocks in run_one()
+        // once nothing was ready for the spin budget
+        inline void run_context(asio::io_context &context, const busy_poll &poll) {
+            if (!poll.Enabled()) {
+                context.run();
+                return;
+            }
+
+            while (!context.stopped()) {
+                auto tIdle = std::chrono::steady_clock::now();
+                while (context.poll() == 0) {
+                    if (context.stopped()) return;
+                    if (std::chrono::steady_clock::now() - tIdle > poll.spin) {
+                        context.run_one();
+                        break;
+                    }
+                    spin_pause();
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "net_common.h"
+
+namespace bsl {
+    namespace net {
+        // Recycles blocks of one size, for objects that come and go all the time like connections. The size is
+        // taken from the first block returned, blocks of other sizes go straight to the heap. Blocks may be
+        // returned from any thread
+        class block_pool {
+        public:
+            explicit block_pool(size_t nMaxFree = 4096) : m_nMaxFree(nMaxFree) {}
+
+            block_pool(const block_pool &) = delete;
+
+            ~block_pool() {
+                for (void *p : m_vFree)
+                    ::operator delete(p);
+            }
+
+        public:
+            void *Allocate(size_t nBytes) {
+                {
+                    std::scoped_lock lock(m_muxFree);
+                    if (nBytes == m_nBlockSize && !m_vFree.empty()) {
+                        void *p = m_vFree.back();
+                        m_vFree.pop_back();
+                        return p;
+                    }
+                }
+                return ::operator new(nBytes);
+            }
+
+            void Deallocate(void *p, size_t nBytes) {
+                {
+                    std::scoped_lock lock(m_muxFree);
+                    if (m_nBlockSize == 0) m_nBlockSize = nBytes;
+                    if (nBytes == m_nBlockSize && m_vFree.size() < m_nMaxFree) {
+                        m_vFree.push_back(p);
+                        return;
+                    }
+                }
+                ::operator delete(p);
+            }
+
+            // Blocks waiting to be reused
+            size_t Free() {
+                std::scoped_lock lock(m_muxFree);
+                return m_vFree.size();
+            }
+
+        private:
+            std::mutex m_muxFree;
+            std::vector<void *> m_vFree;
+            size_t m_nBlockSize = 0;
+            size_t m_nMaxFree;
+        };
+
+        // Allocator drawing from a block_pool, for std::allocate_shared. It keeps the pool alive, so objects may
+        // outlive whoever created them
+        template<typename U>
+        struct pool_allocator {
+            using value_type = U;
+
+            explicit pool_allocator(std::shared_ptr<block_pool> pool) : pPool(std::move(pool)) {}
+
+            template<typename V>
+            pool_allocator(const pool_allocator<V> &other) : pPool(other.pPool) {}
+
+            U *allocate(size_t n) {
+                return static_cast<U *>(pPool->Allocate(n * sizeof(U)));
+            }
+
+            void deallocate(U *p, size_t n) {
+                pPool->Deallocate(p, n * sizeof(U));
+            }
+
+            template<typename V>
+            bool operator==(const pool_allocator<V> &other) const {
+                return pPool == other.pPool;
+            }
+
+            template<typename V>
+            bool operator!=(const pool_allocator<V> &other) const {
+                return pPool != other.pPool;
+            }
+
+            std::shared_ptr<block_pool> pPool;
+        };
+    }
+}
@@ -0,0 +1,189 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+
+namespace bsl {
+    namespace net {
+        // Outbound lanes of a connection. Control is always sent first, the others share the link by weight
+        enum class priority : uint8_t {
+            control,
+            high,
+            normal,
+            bulk
+        };
+
+        constexpr size_t PRIORITY_LANES = 4;
+
+        // Which lane each message id goes to, and how many bytes each weighted lane may send per round
+        template<typename T>
+        class lane_policy {
+        public:
+            void SetPriority(T id, priority lane) {
+                m_mapPriority[id] = lane;
+            }
+
+            priority GetPriority(T id) const {
+                auto it = m_mapPriority.find(id);
+                return it != m_mapPriority.end() ? it->second : priority::normal;
+            }
+
+            // The quantum of the control lane is unused, it is never rate shared
+            void SetQuantum(priority lane, size_t nBytes) {
+                m_nQuantum[size_t(lane)] = std::max<size_t>(nBytes, 1);
+            }
+
+            size_t GetQuantum(priority lane) const {
+                return m_nQuantum[size_t(lane)];
+            }
+
+        private:
+            std::unordered_map<T, priority> m_mapPriority;
+            std::array<size_t, PRIORITY_LANES> m_nQuantum{0, 64 * 1024, 16 * 1024, 4 * 1024};
+        };
+
+        // Outbound queue of a connection, split in priority lanes. Only the context thread touches the messages,
+        // the depths can be read from anywhere. The frame returned by front() stays the same until pop_front(),
+        // lanes are only switched between frames so a message is never interleaved with another one. A lane is
+        // only allocated once something is sent in it, most connections never use most lanes
+        template<typename T>
+        class outbound_lanes {
+        public:
+            outbound_lanes() = default;
+
+            outbound_lanes(const outbound_lanes<T> &) = delete;
+
+        public:
+            void SetPolicy(const lane_policy<T> *pPolicy) {
+                m_pPolicy = pPolicy;
+            }
+
+            // The queued copy stays where it is until it is popped
+            const message<T> &push_back(const message<T> &msg, priority lane) {
+                auto &pLane = m_deqLanes[size_t(lane)];
+                if (!pLane) pLane = std::make_unique<std::deque<message<T>>>();
+                pLane->push_back(msg);
+                m_nDepth[size_t(lane)].fetch_add(1, std::memory_order_relaxed);
+                return pLane->back();
+            }
+
+            // Put a message back in front of its lane, only between frames
+            void push_front(message<T> &&msg, priority lane) {
+                auto &pLane = m_deqLanes[size_t(lane)];
+                if (!pLane) pLane = std::make_unique<std::deque<message<T>>>();
+                pLane->push_front(std::move(msg));
+                m_nDepth[size_t(lane)].fetch_add(1, std::memory_order_relaxed);
+            }
+
+            bool empty() const {
+                for (auto &pLane : m_deqLanes)
+                    if (pLane && !pLane->empty()) return false;
+                return true;
+            }
+
+            // The frame being sent, a new one is picked when the previous one was popped
+            message<T> &front() {
+                if (m_nCurrent == NO_LANE)
+                    m_nCurrent = SelectLane();
+                return m_deqLanes[m_nCurrent]->front();
+            }
+
+            void pop_front() {
+                size_t nLane = m_nCurrent == NO_LANE ? SelectLane() : m_nCurrent;
+                m_deqLanes[nLane]->pop_front();
+                m_nDepth[nLane].fetch_sub(1, std::memory_order_relaxed);
+                m_nCurrent = NO_LANE;
+            }
+
+            // Number of messages waiting in a lane
+            size_t depth(priority lane) const {
+                return m_nDepth[size_t(lane)].load(std::memory_order_relaxed);
+            }
+
+            size_t count() const {
+                size_t nCount = 0;
+                for (auto &nDepth : m_nDepth)
+                    nCount += nDepth.load(std::memory_order_relaxed);
+                return nCount;
+            }
+
+            // Hand every queued message with its lane to fn and empty the queue
+            template<typename Fn>
+            void drain(Fn &&fn) {
+                for (size_t i = 0; i < PRIORITY_LANES; i++)
+                    if (m_deqLanes[i])
+                        for (auto &msg : *m_deqLanes[i])
+                            fn(std::move(msg), priority(i));
+                clear();
+            }
+
+            void clear() {
+                for (size_t i = 0; i < PRIORITY_LANES; i++) {
+                    m_deqLanes[i].reset();
+                    m_nDepth[i].store(0, std::memory_order_relaxed);
+                    m_nDeficit[i] = 0;
+                }
+                m_nCurrent = NO_LANE;
+            }
+
+        private:
+            // Control goes first whenever it has something, the weighted lanes are served by deficit round robin,
+            // each visit grants a lane its quantum and it sends whole frames as long as its deficit covers them.
+            // Must not be called on an empty queue
+            size_t SelectLane() {
+                auto &pControl = m_deqLanes[size_t(priority::control)];
+                if (pControl && !pControl->empty())
+                    return size_t(priority::control);
+
+                for (;;) {
+                    auto &pLane = m_deqLanes[m_nRoundRobin];
+                    if (!pLane || pLane->empty()) {
+                        // Idle lanes don't save up credit
+                        m_nDeficit[m_nRoundRobin] = 0;
+                        NextLane();
+                        continue;
+                    }
+
+                    if (!m_bCredited) {
+                        m_nDeficit[m_nRoundRobin] += Quantum(m_nRoundRobin);
+                        m_bCredited = true;
+                    }
+
+                    size_t nCost = sizeof(message_header<T>) + pLane->front().body.size();
+                    if (nCost <= m_nDeficit[m_nRoundRobin]) {
+                        m_nDeficit[m_nRoundRobin] -= nCost;
+                        return m_nRoundRobin;
+                    }
+
+                    NextLane();
+                }
+            }
+
+            void NextLane() {
+                m_nRoundRobin = m_nRoundRobin % (PRIORITY_LANES - 1) + 1;
+                m_bCredited = false;
+            }
+
+            size_t Quantum(size_t nLane) const {
+                static const lane_policy<T> defaultPolicy;
+                return (m_pPolicy ? m_pPolicy : &defaultPolicy)->GetQuantum(priority(nLane));
+            }
+
+        private:
+            static constexpr size_t NO_LANE = PRIORITY_LANES;
+
+            std::array<std::unique_ptr<std::deque<message<T>>>, PRIORITY_LANES> m_deqLanes;
+            std::array<std::atomic<size_t>, PRIORITY_LANES> m_nDepth{};
+
+            // Deficit round robin state of the weighted lanes
+            std::array<size_t, PRIORITY_LANES> m_nDeficit{};
+            size_t m_nRoundRobin = size_t(priority::high);
+            bool m_bCredited = false;
+
+            // Lane of the frame currently being written
+            size_t m_nCurrent = NO_LANE;
+
+            const lane_policy<T> *m_pPolicy = nullptr;
+        };
+    }
+}
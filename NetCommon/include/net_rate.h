@@ -0,0 +1,146 @@
+#pragma once
+
+#include "net_common.h"
+
+namespace bsl {
+    namespace net {
+        // Bytes of messages a connection may have handled by Update() per round, when several have messages waiting
+        constexpr size_t DEFAULT_INBOUND_QUANTUM = 4 * 1024;
+
+        // Inbound rate of a connection, or of one message id on a connection. A rate of 0 is unlimited, a burst
+        // of 0 is one second worth of the rate
+        struct rate_limit {
+            double dMessagesPerSecond = 0;
+            double dMessageBurst = 0;
+            double dBytesPerSecond = 0;
+            double dByteBurst = 0;
+        };
+
+        // Tokens refill at a steady rate up to the burst size. A cost bigger than the burst is let through once
+        // the bucket is full and leaves it in debt, so the average rate holds either way
+        class token_bucket {
+        public:
+            using clock = std::chrono::steady_clock;
+
+            void Configure(double dRate, double dBurst) {
+                m_dRate = dRate;
+                m_dBurst = dBurst > 0 ? dBurst : dRate;
+                m_dTokens = m_dBurst;
+                m_tLast = clock::now();
+            }
+
+            bool Limited() const {
+                return m_dRate > 0;
+            }
+
+            // How long until dCost may be taken, zero if it may be now
+            clock::duration Wait(double dCost, clock::time_point tNow) {
+                if (!Limited()) return clock::duration::zero();
+
+                m_dTokens = std::min(m_dBurst, m_dTokens + std::chrono::duration<double>(tNow - m_tLast).count() * m_dRate);
+                m_tLast = tNow;
+
+                double dNeeded = std::min(dCost, m_dBurst);
+                if (m_dTokens >= dNeeded) return clock::duration::zero();
+                return std::chrono::duration_cast<clock::duration>(
+                        std::chrono::duration<double>((dNeeded - m_dTokens) / m_dRate));
+            }
+
+            // Call after Wait() said the cost may be taken
+            void Take(double dCost) {
+                if (Limited()) m_dTokens -= dCost;
+            }
+
+        private:
+            double m_dRate = 0;
+            double m_dBurst = 0;
+            double m_dTokens = 0;
+            clock::time_point m_tLast;
+        };
+
+        // Server wide configuration: the limit every connection gets, and limits of specific ids on top of it
+        template<typename T>
+        class rate_limits {
+        public:
+            void SetDefault(const rate_limit &limit) {
+                m_default = limit;
+            }
+
+            void Set(T id, const rate_limit &limit) {
+                m_mapLimits[id] = limit;
+            }
+
+            const rate_limit &Default() const {
+                return m_default;
+            }
+
+            const rate_limit *Get(T id) const {
+                auto it = m_mapLimits.find(id);
+                return it != m_mapLimits.end() ? &it->second : nullptr;
+            }
+
+            bool Enabled() const {
+                return m_default.dMessagesPerSecond > 0 || m_default.dBytesPerSecond > 0 || !m_mapLimits.empty();
+            }
+
+        private:
+            rate_limit m_default;
+            std::unordered_map<T, rate_limit> m_mapLimits;
+        };
+
+        // The buckets of one connection, only used from its strand
+        template<typename T>
+        class connection_rate {
+        public:
+            // How long until a message of this id and body size may be read, zero if it was charged now
+            token_bucket::clock::duration Charge(const rate_limits<T> &limits, T id, size_t nBytes) {
+                auto tNow = token_bucket::clock::now();
+
+                if (!m_bConfigured) {
+                    Configure(m_buckets, limits.Default());
+                    m_bConfigured = true;
+                }
+
+                buckets *pIdBuckets = nullptr;
+                if (const rate_limit *pLimit = limits.Get(id)) {
+                    auto it = m_mapIdBuckets.find(id);
+                    if (it == m_mapIdBuckets.end()) {
+                        it = m_mapIdBuckets.emplace(id, buckets{}).first;
+                        Configure(it->second, *pLimit);
+                    }
+                    pIdBuckets = &it->second;
+                }
+
+                // Only charge once every bucket has enough, the longest wait decides
+                auto wait = std::max(m_buckets.messages.Wait(1, tNow), m_buckets.bytes.Wait(double(nBytes), tNow));
+                if (pIdBuckets)
+                    wait = std::max({wait, pIdBuckets->messages.Wait(1, tNow), pIdBuckets->bytes.Wait(double(nBytes), tNow)});
+                if (wait > token_bucket::clock::duration::zero()) return wait;
+
+                m_buckets.messages.Take(1);
+                m_buckets.bytes.Take(double(nBytes));
+                if (pIdBuckets) {
+                    pIdBuckets->messages.Take(1);
+                    pIdBuckets->bytes.Take(double(nBytes));
+                }
+                return wait;
+            }
+
+        private:
+            struct buckets {
+                token_bucket messages;
+                token_bucket bytes;
+            };
+
+            static void Configure(buckets &b, const rate_limit &limit) {
+                b.messages.Configure(limit.dMessagesPerSecond, limit.dMessageBurst);
+                b.bytes.Configure(limit.dBytesPerSecond, limit.dByteBurst);
+            }
+
+        private:
+            bool m_bConfigured = false;
+            buckets m_buckets;
+            std::unordered_map<T, buckets> m_mapIdBuckets;
+        };
+    }
+}
@@ -0,0 +1,489 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_connection.h"
+
+namespace bsl {
+    namespace net {
+        // Packs values of any bit width back to back, least significant bit first
+        class bit_writer {
+        public:
+            void Write(uint64_t nValue, uint32_t nBits) {
+                while (nBits > 0) {
+                    uint32_t nChunk = std::min<uint32_t>(nBits, 32);
+                    m_nScratch |= (nValue & ((uint64_t(1) << nChunk) - 1)) << m_nScratchBits;
+                    m_nScratchBits += nChunk;
+                    while (m_nScratchBits >= 8) {
+                        m_vData.push_back(uint8_t(m_nScratch));
+                        m_nScratch >>= 8;
+                        m_nScratchBits -= 8;
+                    }
+                    nValue >>= nChunk;
+                    nBits -= nChunk;
+                }
+            }
+
+            // Small numbers are common, a 2 bit size class is followed by 4, 8, 16 or 32 bits
+            void WriteVar(uint32_t nValue) {
+                uint32_t nClass = nValue < (1u << 4) ? 0 : nValue < (1u << 8) ? 1 : nValue < (1u << 16) ? 2 : 3;
+                Write(nClass, 2);
+                Write(nValue, 4u << nClass);
+            }
+
+            // Flush the last partial byte and hand out the data
+            std::vector<uint8_t> Finish() {
+                if (m_nScratchBits > 0)
+                    m_vData.push_back(uint8_t(m_nScratch));
+                m_nScratch = 0;
+                m_nScratchBits = 0;
+                return std::move(m_vData);
+            }
+
+        private:
+            std::vector<uint8_t> m_vData;
+            uint64_t m_nScratch = 0;
+            uint32_t m_nScratchBits = 0;
+        };
+
+        // Reads what bit_writer wrote. Reading past the end gives zeros and sets Overrun()
+        class bit_reader {
+        public:
+            bit_reader(const uint8_t *pData, size_t nSize) : m_pData(pData), m_nSize(nSize) {}
+
+            uint64_t Read(uint32_t nBits) {
+                uint64_t nValue = 0;
+                uint32_t nShift = 0;
+                while (nBits > 0) {
+                    uint32_t nChunk = std::min<uint32_t>(nBits, 32);
+                    while (m_nScratchBits < nChunk) {
+                        if (m_nOffset < m_nSize) {
+                            m_nScratch |= uint64_t(m_pData[m_nOffset++]) << m_nScratchBits;
+                        } else {
+                            m_bOverrun = true;
+                        }
+                        m_nScratchBits += 8;
+                    }
+                    nValue |= (m_nScratch & ((uint64_t(1) << nChunk) - 1)) << nShift;
+                    m_nScratch >>= nChunk;
+                    m_nScratchBits -= nChunk;
+                    nShift += nChunk;
+                    nBits -= nChunk;
+                }
+                return nValue;
+            }
+
+            uint32_t ReadVar() {
+                uint32_t nClass = uint32_t(Read(2));
+                return uint32_t(Read(4u << nClass));
+            }
+
+            bool Overrun() const {
+                return m_bOverrun;
+            }
+
+        private:
+            const uint8_t *m_pData;
+            size_t m_nSize;
+            size_t m_nOffset = 0;
+            uint64_t m_nScratch = 0;
+            uint32_t m_nScratchBits = 0;
+            bool m_bOverrun = false;
+        };
+
+        // A snapshot body is the tick, the tick it is a delta against (0 for the full state), then entries of
+        //   1 bit more, var object id gap, 2 bit kind, and by kind:
+        //   create: var field count, 6 bits (width - 1) per field, every value
+        //   update: a bit mask of the fields that changed, their values
+        //   remove: nothing
+        // terminated by a 0 more bit. Values take exactly the width of their field
+        enum class replication_entry : uint8_t {
+            create,
+            update,
+            remove
+        };
+
+        struct replication_stats {
+            uint32_t nTick = 0;
+            // Clients sent a snapshot, and clients held back because too many of their snapshots are unacknowledged
+            size_t nClientsSent = 0;
+            size_t nClientsSkipped = 0;
+            // Deltas encoded, clients that are equally up to date share one
+            size_t nEncodings = 0;
+            // Body bytes queued to all clients
+            size_t nBytes = 0;
+        };
+
+        // Server side of state replication. The server registers objects made of fields of fixed bit widths and
+        // sets their values, Tick() sends every client what changed since the last snapshot it was sent. TCP
+        // delivers every snapshot in order, so that is the state the client is going to have. Acks tell how far
+        // behind a client is: a client with too many unacknowledged ticks is skipped, and picks up everything it
+        // missed with the next delta it gets. Tick() and OnAck() must run on the same thread, normally Update()'s
+        template<typename T>
+        class replication_server {
+        public:
+            replication_server(T snapshotId, T ackId) : m_snapshotId(snapshotId), m_ackId(ackId) {}
+
+        public:
+            // Add an object with a field of each given width, 1 to 64 bits. Values start at 0
+            uint32_t AddObject(const std::vector<uint8_t> &vFieldBits) {
+                uint32_t nObject = m_nNextObject++;
+                object_state &object = m_mapObjects[nObject];
+                for (uint8_t nBits : vFieldBits)
+                    object.vBits.push_back(std::min<uint8_t>(std::max<uint8_t>(nBits, 1), 64));
+                object.vValues.resize(vFieldBits.size());
+                object.vChanged.resize(vFieldBits.size(), NextTick());
+                object.nCreated = object.nChanged = m_nLastChange = NextTick();
+                m_deqChanges.emplace_back(NextTick(), nObject);
+                return nObject;
+            }
+
+            void RemoveObject(uint32_t nObject) {
+                auto it = m_mapObjects.find(nObject);
+                if (it == m_mapObjects.end() || it->second.nRemoved) return;
+
+                // No client has heard of it yet
+                if (it->second.nCreated == NextTick()) {
+                    m_mapObjects.erase(it);
+                    return;
+                }
+                if (it->second.nChanged != NextTick())
+                    m_deqChanges.emplace_back(NextTick(), nObject);
+                it->second.nRemoved = it->second.nChanged = m_nLastChange = NextTick();
+            }
+
+            // Values are cut to the width of their field, quantizing anything else is up to the caller
+            void Set(uint32_t nObject, size_t nField, uint64_t nValue) {
+                auto it = m_mapObjects.find(nObject);
+                if (it == m_mapObjects.end() || it->second.nRemoved || nField >= it->second.vValues.size()) return;
+
+                object_state &object = it->second;
+                nValue &= FieldMask(object.vBits[nField]);
+                if (object.vValues[nField] != nValue) {
+                    if (object.nChanged != NextTick())
+                        m_deqChanges.emplace_back(NextTick(), nObject);
+                    object.vValues[nField] = nValue;
+                    object.vChanged[nField] = object.nChanged = m_nLastChange = NextTick();
+                }
+            }
+
+            uint64_t Get(uint32_t nObject, size_t nField) const {
+                auto it = m_mapObjects.find(nObject);
+                return it != m_mapObjects.end() && nField < it->second.vValues.size() ? it->second.vValues[nField] : 0;
+            }
+
+            // Ticks a client may be sent ahead of its last ack before it is skipped
+            void SetMaxUnacked(uint32_t nTicks) {
+                m_nMaxUnacked = std::max<uint32_t>(nTicks, 1);
+            }
+
+            uint32_t CurrentTick() const {
+                return m_nTick;
+            }
+
+            const replication_stats &Stats() const {
+                return m_stats;
+            }
+
+            // Pass every message from a client here, returns true if it was an ack and has been consumed
+            bool OnAck(const std::shared_ptr<connection<T>> &client, message<T> &msg) {
+                if (!client || msg.header.id != m_ackId) return false;
+
+                uint32_t nTick = 0;
+                if (msg.size() >= sizeof(nTick)) msg >> nTick;
+
+                auto it = m_mapClients.find(client->GetID());
+                if (it != m_mapClients.end() && nTick <= it->second.nSent)
+                    it->second.nAcked = std::max(it->second.nAcked, nTick);
+                return true;
+            }
+
+            // Take a snapshot and send each client its delta. Clients not in the list are forgotten
+            void Tick(const std::deque<std::shared_ptr<connection<T>>> &clients) {
+                m_nTick++;
+                m_stats = {};
+                m_stats.nTick = m_nTick;
+
+                // Deltas by the tick they are against
+                std::unordered_map<uint32_t, message<T>> mapDeltas;
+                uint32_t nOldestSent = m_nTick;
+
+                for (auto &client : clients) {
+                    if (!client || !client->IsConnected()) continue;
+
+                    auto itClient = m_mapClients.find(client->GetID());
+                    if (itClient == m_mapClients.end()) {
+                        itClient = m_mapClients.emplace(client->GetID(), client_state{}).first;
+                        itClient->second.nAcked = m_nTick - 1;
+                    }
+                    client_state &state = itClient->second;
+                    state.nSeen = m_nTick;
+
+                    // Removals it may not have heard of are forgotten, start it over with the full state
+                    if (state.nSent != 0 && state.nSent < m_nPrunedTick)
+                        state.nSent = 0;
+
+                    if (state.nSent != 0) nOldestSent = std::min(nOldestSent, state.nSent);
+
+                    // It already has everything
+                    if (state.nSent >= m_nLastChange) continue;
+
+                    if (state.nSent != 0 && state.nSent - state.nAcked >= m_nMaxUnacked) {
+                        m_stats.nClientsSkipped++;
+                        continue;
+                    }
+
+                    auto itDelta = mapDeltas.find(state.nSent);
+                    if (itDelta == mapDeltas.end()) {
+                        itDelta = mapDeltas.emplace(state.nSent, Encode(state.nSent)).first;
+                        m_stats.nEncodings++;
+                    }
+                    client->Send(itDelta->second);
+                    state.nSent = m_nTick;
+                    m_stats.nClientsSent++;
+                    m_stats.nBytes += itDelta->second.size();
+                }
+
+                for (auto it = m_mapClients.begin(); it != m_mapClients.end();)
+                    it = it->second.nSeen != m_nTick ? m_mapClients.erase(it) : std::next(it);
+
+                Prune(nOldestSent);
+            }
+
+        private:
+            struct object_state {
+                std::vector<uint8_t> vBits;
+                std::vector<uint64_t> vValues;
+                // Tick each field last changed in
+                std::vector<uint32_t> vChanged;
+                uint32_t nCreated = 0;
+                uint32_t nChanged = 0;
+                uint32_t nRemoved = 0;
+            };
+
+            struct client_state {
+                uint32_t nSent = 0;
+                uint32_t nAcked = 0;
+                uint32_t nSeen = 0;
+            };
+
+            // Changes are kept at most this long for clients that haven't been sent them
+            static constexpr uint32_t HISTORY_TICKS = 1024;
+
+            // Changes made now are part of the next snapshot
+            uint32_t NextTick() const {
+                return m_nTick + 1;
+            }
+
+            static uint64_t FieldMask(uint8_t nBits) {
+                return nBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << nBits) - 1;
+            }
+
+            // Everything that changed after nBaseline. A delta only visits the objects the change log names, the
+            // full state visits all of them
+            message<T> Encode(uint32_t nBaseline) const {
+                bit_writer writer;
+                writer.Write(m_nTick, 32);
+                writer.Write(nBaseline, 32);
+
+                std::vector<uint32_t> vChanged;
+                if (nBaseline != 0) {
+                    auto itFirst = std::partition_point(m_deqChanges.begin(), m_deqChanges.end(),
+                                                        [nBaseline](const auto &change) { return change.first <= nBaseline; });
+                    for (auto it = itFirst; it != m_deqChanges.end(); ++it)
+                        vChanged.push_back(it->second);
+                    std::sort(vChanged.begin(), vChanged.end());
+                    vChanged.erase(std::unique(vChanged.begin(), vChanged.end()), vChanged.end());
+                }
+
+                uint32_t nPrevious = 0;
+                auto encodeObject = [&](uint32_t nObject, const object_state &object) {
+
+                    replication_entry kind;
+                    if (object.nRemoved) {
+                        // Only clients that know the object need to hear it is gone
+                        if (object.nRemoved <= nBaseline || object.nCreated > nBaseline) return;
+                        kind = replication_entry::remove;
+                    } else if (object.nCreated > nBaseline) {
+                        kind = replication_entry::create;
+                    } else if (object.nChanged > nBaseline) {
+                        kind = replication_entry::update;
+                    } else {
+                        return;
+                    }
+
+                    writer.Write(1, 1);
+                    writer.WriteVar(nObject - nPrevious);
+                    writer.Write(uint8_t(kind), 2);
+                    nPrevious = nObject;
+
+                    size_t nFields = object.vValues.size();
+                    if (kind == replication_entry::create) {
+                        writer.WriteVar(uint32_t(nFields));
+                        for (uint8_t nBits : object.vBits)
+                            writer.Write(nBits - 1, 6);
+                        for (size_t i = 0; i < nFields; i++)
+                            writer.Write(object.vValues[i], object.vBits[i]);
+                    } else if (kind == replication_entry::update) {
+                        for (size_t i = 0; i < nFields; i++)
+                            writer.Write(object.vChanged[i] > nBaseline, 1);
+                        for (size_t i = 0; i < nFields; i++)
+                            if (object.vChanged[i] > nBaseline)
+                                writer.Write(object.vValues[i], object.vBits[i]);
+                    }
+                };
+
+                if (nBaseline == 0) {
+                    for (auto &entry : m_mapObjects)
+                        encodeObject(entry.first, entry.second);
+                } else {
+                    for (uint32_t nObject : vChanged) {
+                        auto it = m_mapObjects.find(nObject);
+                        if (it != m_mapObjects.end())
+                            encodeObject(nObject, it->second);
+                    }
+                }
+                writer.Write(0, 1);
+
+                message<T> msg;
+                msg.header.id = m_snapshotId;
+                msg.body = writer.Finish();
+                msg.header.size = uint32_t(msg.size());
+                return msg;
+            }
+
+            // Forget changes every client has been sent, or that are too old to wait for, along with the objects
+            // they removed. Clients still needing them get the full state next time
+            void Prune(uint32_t nOldestSent) {
+                while (!m_deqChanges.empty()) {
+                    uint32_t nTick = m_deqChanges.front().first;
+                    if (nTick > nOldestSent && nTick + HISTORY_TICKS >= m_nTick) break;
+                    if (nTick > nOldestSent)
+                        m_nPrunedTick = std::max(m_nPrunedTick, nTick);
+
+                    auto it = m_mapObjects.find(m_deqChanges.front().second);
+                    if (it != m_mapObjects.end() && it->second.nRemoved == nTick)
+                        m_mapObjects.erase(it);
+                    m_deqChanges.pop_front();
+                }
+            }
+
+        private:
+            T m_snapshotId;
+            T m_ackId;
+
+            std::map<uint32_t, object_state> m_mapObjects;
+            uint32_t m_nNextObject = 1;
+
+            // {tick, object} for the first change of an object in each tick, oldest first
+            std::deque<std::pair<uint32_t, uint32_t>> m_deqChanges;
+
+            std::unordered_map<uint32_t, client_state> m_mapClients;
+
+            uint32_t m_nTick = 0;
+            uint32_t m_nLastChange = 0;
+            // Clients sent nothing since this tick may miss changes that were pruned
+            uint32_t m_nPrunedTick = 0;
+            uint32_t m_nMaxUnacked = 32;
+
+            replication_stats m_stats;
+        };
+
+        // Fields of a replicated object as the client sees them
+        struct replicated_object {
+            std::vector<uint8_t> vBits;
+            std::vector<uint64_t> vValues;
+        };
+
+        // Client side of state replication, applies snapshots to its copy of the objects and acks them
+        template<typename T>
+        class replication_client {
+        public:
+            replication_client(T snapshotId, T ackId) : m_snapshotId(snapshotId), m_ackId(ackId) {}
+
+        public:
+            // Apply a snapshot and fill ack with the message to send back. Returns false if the message is no
+            // snapshot, or is malformed, in which case the objects may be partly updated
+            bool Apply(const message<T> &msg, message<T> &ack) {
+                if (msg.header.id != m_snapshotId) return false;
+
+                bit_reader reader(msg.body.data(), msg.body.size());
+                uint32_t nTick = uint32_t(reader.Read(32));
+                uint32_t nBaseline = uint32_t(reader.Read(32));
+
+                // A full state replaces everything, a delta is against a state this side must have reached
+                if (nBaseline == 0)
+                    m_mapObjects.clear();
+                else if (nBaseline > m_nTick)
+                    return false;
+
+                uint32_t nObject = 0;
+                while (reader.Read(1) && !reader.Overrun()) {
+                    nObject += reader.ReadVar();
+                    auto kind = replication_entry(reader.Read(2));
+
+                    if (kind == replication_entry::create) {
+                        replicated_object &object = m_mapObjects[nObject];
+                        size_t nFields = reader.ReadVar();
+                        if (nFields > msg.body.size() * 8) return false;
+                        object.vBits.resize(nFields);
+                        object.vValues.resize(nFields);
+                        for (auto &nBits : object.vBits)
+                            nBits = uint8_t(reader.Read(6) + 1);
+                        for (size_t i = 0; i < nFields; i++)
+                            object.vValues[i] = reader.Read(object.vBits[i]);
+                    } else if (kind == replication_entry::update) {
+                        auto it = m_mapObjects.find(nObject);
+                        if (it == m_mapObjects.end()) return false;
+
+                        replicated_object &object = it->second;
+                        m_vChanged.resize(object.vValues.size());
+                        for (auto &&bChanged : m_vChanged)
+                            bChanged = reader.Read(1);
+                        for (size_t i = 0; i < object.vValues.size(); i++)
+                            if (m_vChanged[i])
+                                object.vValues[i] = reader.Read(object.vBits[i]);
+                    } else if (kind == replication_entry::remove) {
+                        m_mapObjects.erase(nObject);
+                    } else {
+                        return false;
+                    }
+                }
+                if (reader.Overrun()) return false;
+
+                m_nTick = nTick;
+
+                ack = {};
+                ack.header.id = m_ackId;
+                ack << nTick;
+                return true;
+            }
+
+            // Tick of the last snapshot applied
+            uint32_t CurrentTick() const {
+                return m_nTick;
+            }
+
+            bool Has(uint32_t nObject) const {
+                return m_mapObjects.count(nObject) > 0;
+            }
+
+            uint64_t Get(uint32_t nObject, size_t nField) const {
+                auto it = m_mapObjects.find(nObject);
+                return it != m_mapObjects.end() && nField < it->second.vValues.size() ? it->second.vValues[nField] : 0;
+            }
+
+            const std::map<uint32_t, replicated_object> &Objects() const {
+                return m_mapObjects;
+            }
+
+        private:
+            T m_snapshotId;
+            T m_ackId;
+
+            std::map<uint32_t, replicated_object> m_mapObjects;
+            std::vector<bool> m_vChanged;
+            uint32_t m_nTick = 0;
+        };
+    }
+}
@@ -3,10 +3,42 @@
 #include "net_common.h"
 #include "net_tsqueue.h"
 #include "net_message.h"
+#include "net_memory.h"
+#include "net_rate.h"
+#include "net_pool.h"
+#include "net_priority.h"
+#include "net_capture.h"
+#include "net_tls.h"
+#include "net_wire.h"
+#include "net_session.h"
+#include "net_poll.h"
 #include "net_connection.h"
 
 namespace bsl {
     namespace net {
+        // How long accepting pauses after an accept failed, e.g. because the descriptors ran out
+        constexpr std::chrono::milliseconds ACCEPT_RETRY_DELAY{10};
+
+        // The accept rate is measured over windows this long, closed by a timer so a burst registers even when
+        // no accept follows it
+        constexpr std::chrono::milliseconds ACCEPT_RATE_WINDOW{100};
+
+        // What the accept path has done so far, the rates are accepts per second
+        struct accept_stats {
+            uint64_t nAccepted = 0;
+            uint64_t nAdmitted = 0;
+            uint64_t nDenied = 0;
+            // Accepts that failed
+            uint64_t nErrors = 0;
+            // Accepted clients that closed before they were admitted, with sessions they negotiate first
+            uint64_t nDropped = 0;
+            // Accepted clients OnClientConnectAsync() hasn't decided on yet, or that are still negotiating
+            uint64_t nPending = 0;
+            // Accepts per second in the latest window, and the highest of any window
+            uint64_t nRate = 0;
+            uint64_t nPeakRate = 0;
+        };
+
         template<typename T>
         class server_interface {
         public:
@@ -23,11 +55,19 @@ namespace bsl {
             // Starts the server
             bool Start() {
                 try {
-                    // Prime the asio context to do some work, because this is a server, so it should wait client connection
-                    WaitForClientConnection();
-
-                    // Run context in it's thread
-                    m_threadContext = std::thread([this]() { m_asioContext.run(); });
+                    // Prime the asio context to do some work, because this is a server, so it should wait client connection.
+                    // Each outstanding accept takes one client when the listening socket wakes up
+                    for (size_t i = 0; i < m_nAcceptConcurrency; i++)
+                        WaitForClientConnection();
+
+                    m_tRateWindow = std::chrono::steady_clock::now();
+                    m_nRateWindowStart = m_nAccepted.load();
+                    MeasureAcceptRate();
+                    if (m_sessions.Enabled())
+                        ExpireSessions();
+
+                    // Run context in it's thread, spinning before it sleeps in low latency mode
+                    m_threadContext = std::thread([this]() { run_context(m_asioContext, m_busyPoll); });
                 }
                 catch (std::exception &e) {
                     std::cerr << "[SERVER] Exception: " << e.what() << "\n";
@@ -49,40 +89,204 @@ namespace bsl {
                 std::cout << "[SERVER] Stopped!\n";
             }
 
-            // ASYNC - Instruct asio to wait for connection
-            void WaitForClientConnection() {
-                // Prime context with an instruction to wait until a socket connects. It will provide a unique socket for each incoming connection
-                m_asioAcceptor.async_accept(
-                        [this](std::error_code ec, asio::ip::tcp::socket socket) {
-                            if (!ec) {
-                                std::cout << "[SERVER] New Connection: " << socket.remote_endpoint() << "\n";
+#ifdef BSL_NET_TLS
+            // Accept clients over TLS only, call before Start()
+            void EnableTls(const tls_config &config) {
+                m_tlsContext = std::make_unique<tls_server_context>(config);
+            }
+#endif
+
+            // Only complete an accept once the client has sent something, or nSeconds have passed. Clients that
+            // connect and never speak then cost a kernel entry instead of a connection, but clients that wait for
+            // the server to speak first are held up by nSeconds. Linux only
+            bool SetDeferAccept(int nSeconds) {
+#ifdef TCP_DEFER_ACCEPT
+                return ::setsockopt(m_asioAcceptor.native_handle(), IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                                    &nSeconds, sizeof(nSeconds)) == 0;
+#else
+                std::cerr << "[SERVER] Deferred accept not supported on this platform\n";
+                return false;
+#endif
+            }
 
-                                // Create a new connection to handle this client
-                                std::shared_ptr<connection<T>> newconn =
-                                        std::make_shared<connection<T>>(connection<T>::owner::server,
-                                                                        m_asioContext, std::move(socket),
-                                                                        m_qMessagesIn);
+            // Trade cores for latency: the io thread and Update(bWait = true) spin for up to spin before they sleep,
+            // and client sockets get TCP_NODELAY and SO_BUSY_POLL of nSocketMicros. Returns false if the kernel
+            // doesn't allow that busy poll, the rest still applies. Configure before Start()
+            bool SetBusyPoll(std::chrono::microseconds spin, int nSocketMicros = 50) {
+                m_busyPoll.spin = spin;
+                m_busyPoll.nSocketMicros = nSocketMicros;
+#ifdef SO_BUSY_POLL
+                if (spin.count() > 0 && nSocketMicros > 0 &&
+                    ::setsockopt(m_asioAcceptor.native_handle(), SOL_SOCKET, SO_BUSY_POLL,
+                                 &nSocketMicros, sizeof(nSocketMicros)) != 0) {
+                    std::cerr << "[SERVER] Socket busy poll not permitted\n";
+                    return false;
+                }
+#endif
+                return true;
+            }
 
+            // Keep nAccepts accepts outstanding, one wakeup of the listening socket then accepts as many clients
+            // as are waiting, up to nAccepts. Configure before Start()
+            void SetAcceptConcurrency(size_t nAccepts) {
+                m_nAcceptConcurrency = std::max<size_t>(nAccepts, 1);
+            }
 
+            // Clients the kernel keeps waiting for an accept, beyond that their connection attempts are dropped and
+            // retried a second or more later. Capped by net.core.somaxconn on Linux. Configure before Start()
+            bool SetListenBacklog(int nBacklog) {
+                std::error_code ec;
+                m_asioAcceptor.listen(nBacklog, ec);
+                if (ec) std::cerr << "[SERVER] Listen Backlog Fail: " << ec.message() << "\n";
+                return !ec;
+            }
+
+            // Print a line for every client that connects, is approved or denied. Printing is synchronous, turn it
+            // off if thousands of clients may connect at once
+            void SetConnectionLogging(bool bEnabled) {
+                m_bLogConnections = bEnabled;
+            }
+
+            accept_stats GetAcceptStats() const {
+                accept_stats stats;
+                stats.nAccepted = m_nAccepted.load(std::memory_order_relaxed);
+                stats.nAdmitted = m_nAdmitted.load(std::memory_order_relaxed);
+                stats.nDenied = m_nDenied.load(std::memory_order_relaxed);
+                stats.nErrors = m_nAcceptErrors.load(std::memory_order_relaxed);
+                stats.nDropped = m_nDropped.load(std::memory_order_relaxed);
+                stats.nPending = stats.nAccepted - stats.nAdmitted - stats.nDenied - stats.nDropped;
+                stats.nRate = m_nAcceptRate.load(std::memory_order_relaxed);
+                stats.nPeakRate = m_nPeakAcceptRate.load(std::memory_order_relaxed);
+                return stats;
+            }
+
+            // Limit the bytes held by receive buffers, the incoming queue and session replay buffers across all clients
+            void SetMemoryBudget(size_t nBytes) {
+                m_memoryBudget.SetLimit(nBytes);
+            }
 
-                                // OnClientConnect function will return bool
-                                if (OnClientConnect(newconn)) {
-                                    // Connection allowed, so add to connection container
-                                    m_deqConnections.push_back(std::move(newconn));
+            // Limit the body size clients may send, for all ids or for a specific one. Configure before Start()
+            void SetMaxFrameSize(uint32_t nMaxSize) {
+                m_frameLimits.SetDefault(nMaxSize);
+            }
+
+            void SetMaxFrameSize(T id, uint32_t nMaxSize) {
+                m_frameLimits.Set(id, nMaxSize);
+            }
 
-                                    // Set the asio context to read of the header from the client
-                                    m_deqConnections.back()->ConnectToClient(nIDCounter++);
+            // Limit the rate every client may send at, and additionally the rate of a specific id. A client over its
+            // limits isn't read from until they refill. Configure before Start()
+            void SetRateLimit(const rate_limit &limit) {
+                m_rateLimits.SetDefault(limit);
+            }
 
-                                    std::cout << "[" << m_deqConnections.back()->GetID() << "] Connection Approved\n";
-                                } else {
-                                    std::cout << "[-----] Connection Denied\n";
-                                }
-                            } else {
+            void SetRateLimit(T id, const rate_limit &limit) {
+                m_rateLimits.Set(id, limit);
+            }
+
+            // Bytes of messages of one client Update() handles per round, before moving on to the next client that
+            // has messages waiting
+            void SetInboundQuantum(size_t nBytes) {
+                m_nInboundQuantum = std::max<size_t>(nBytes, 1);
+            }
+
+            // Send messages with this id in a specific lane, e.g. priority::control for pings. Configure before Start()
+            void SetPriority(T id, priority lane) {
+                m_lanePolicy.SetPriority(id, lane);
+            }
+
+            // Bytes a weighted lane may send per round when lanes compete, sets the ratio between them
+            void SetLaneQuantum(priority lane, size_t nBytes) {
+                m_lanePolicy.SetQuantum(lane, nBytes);
+            }
+
+            // Let clients that ask for it speak the compact wire format. Until a client has sent its first bytes
+            // nothing is sent to it, as they tell whether it negotiates. Configure before Start()
+            void SetWireFormat(wire_format format) {
+                m_wireFormat = format;
+            }
+
+            // Let clients that enable sessions resume them after their connection dropped: what they missed is sent
+            // again, and the connection keeps the client id. Clients negotiate their session before they are
+            // admitted, one resuming its session isn't asked about again, OnClientResumed() is called instead. Each
+            // session keeps up to nMaxReplayBytes of messages the client hasn't acknowledged, and is forgotten once
+            // the client has been gone for timeout. Those bytes count against SetMemoryBudget() like what arrives,
+            // when it is used up sessions keep fewer messages and may not be resumed. Sessions need the compact wire
+            // format, so this enables it too. Configure before Start()
+            void EnableSessions(size_t nMaxReplayBytes = DEFAULT_REPLAY_BYTES,
+                                std::chrono::seconds timeout = DEFAULT_SESSION_TIMEOUT) {
+                m_sessions.Configure(nMaxReplayBytes, timeout, &m_memoryBudget);
+                m_wireFormat = wire_format::compact;
+            }
+
+            // Number of sessions the server remembers, including those of clients that are gone for now
+            size_t GetSessionCount() const {
+                return m_sessions.Count();
+            }
+
+            // Record all traffic of all clients to a memory mapped file of at most nCapacity bytes, for NetReplay
+            bool StartCapture(const std::string &sPath, size_t nCapacity = size_t(1) << 30) {
+                return m_capture.Open(sPath, 0, nCapacity);
+            }
+
+            void StopCapture() {
+                m_capture.Close();
+            }
+
+            // Time 1 of every nSampleEvery messages through the stages from socket to OnMessage() and from Send() to
+            // the socket. The latest nMaxSpans stages are kept for GetTracer().WriteChromeTrace(). Stopped, tracing
+            // costs a load and a branch per message
+            void StartTrace(uint32_t nSampleEvery = 100, size_t nMaxSpans = 100000) {
+                m_tracer.Enable(nSampleEvery, nMaxSpans);
+            }
+
+            void StopTrace() {
+                m_tracer.Disable();
+            }
+
+            // Per stage latency histograms of the traced messages, and their spans
+            tracer &GetTracer() {
+                return m_tracer;
+            }
+
+            // Bytes of the memory budget in use by all clients
+            size_t GetMemoryUsed() const {
+                return m_memoryBudget.Used();
+            }
+
+            // Memory held by each client as {client id, bytes}, largest first
+            std::vector<std::pair<uint32_t, size_t>> GetMemoryUsage() const {
+                std::vector<std::pair<uint32_t, size_t>> vUsage;
+                for (auto &client : m_deqConnections)
+                    if (client)
+                        vUsage.emplace_back(client->GetID(), client->GetMemoryHeld());
+
+                std::sort(vUsage.begin(), vUsage.end(),
+                          [](const auto &a, const auto &b) { return a.second > b.second; });
+                return vUsage;
+            }
+
+            // ASYNC - Instruct asio to wait for connection
+            void WaitForClientConnection() {
+                // Prime context with an instruction to wait until a socket connects. It will provide a unique socket for each incoming connection
+                m_asioAcceptor.async_accept(
+                        // Every connection gets a strand of its own
+                        asio::make_strand(m_asioContext),
+                        [this](std::error_code ec, asio::ip::tcp::socket socket) {
+                            if (ec) {
+                                if (ec == asio::error::operation_aborted) return;
                                 std::cout << "[SERVER] New Connection Error: " << ec.message() << "\n";
+                                m_nAcceptErrors++;
+
+                                // Accepting right away would most likely fail the same way, give it a moment
+                                auto pTimer = std::make_shared<asio::steady_timer>(m_asioContext, ACCEPT_RETRY_DELAY);
+                                pTimer->async_wait([this, pTimer](std::error_code) { WaitForClientConnection(); });
+                                return;
                             }
 
-                            // Prime the asio context to wait for client connection agine
+                            // Prime the asio context to wait for client connection agine, before this one is set up
                             WaitForClientConnection();
+                            OnAccepted(std::move(socket));
                         });
             }
 
@@ -92,8 +296,10 @@ namespace bsl {
                 if (client && client->IsConnected()) {
                     client->Send(msg);
                 } else {
-                    // If the client is invalid, means that we can't communicate with it, so we need to disconnect it
-                    OnClientDisconnect(client);
+                    // If the client is invalid, means that we can't communicate with it, so we need to disconnect it.
+                    // Unless it resumed its session on another connection, then it is still there
+                    if (!client || !client->IsSuperseded())
+                        OnClientDisconnect(client);
                     client.reset();
 
                     // Then remove it from the container
@@ -114,8 +320,9 @@ namespace bsl {
                         if (client != pIgnoreClient)
                             client->Send(msg);
                     } else {
-                        // We can't communicate with the client, disconnect it
-                        OnClientDisconnect(client);
+                        // We can't communicate with the client, disconnect it, unless it went on with a new connection
+                        if (!client || !client->IsSuperseded())
+                            OnClientDisconnect(client);
                         client.reset();
 
                         bInvalidClientExists = true;
@@ -130,20 +337,64 @@ namespace bsl {
                             m_deqConnections.end());
             }
 
-            // Force server to respond to incoming messages
+            // Force server to respond to incoming messages. Clients take turns, each gets a quantum of bytes per round,
+            // so one flooding the queue can't hold up the messages of the others
             void Update(size_t nMaxMessages = -1, bool bWait = false) {
-                if (bWait) m_qMessagesIn.wait();
+                if (bWait && m_lstInbound.empty()) m_qMessagesIn.wait(m_busyPoll.spin);
 
-                // Process as many messages
-                size_t nMessageCount = 0;
-                while (nMessageCount < nMaxMessages && !m_qMessagesIn.empty()) {
-                    // Grab the front message
+                // Sort what has arrived by client, it stays charged to the memory budget until it is handled. A client
+                // that resumed its session is the same client as the connection it replaced, so what is left of the
+                // messages of that one is handled first
+                while (!m_qMessagesIn.empty()) {
                     auto msg = m_qMessagesIn.pop_front();
+                    const void *pClient = msg.remote.get();
+                    if (msg.remote && msg.remote->GetSession())
+                        pClient = msg.remote->GetSession();
+                    auto it = m_mapInbound.find(pClient);
+                    if (it == m_mapInbound.end()) {
+                        m_lstInbound.push_back({pClient, {}, 0});
+                        it = m_mapInbound.emplace(pClient, std::prev(m_lstInbound.end())).first;
+                    }
+                    it->second->deqMessages.push_back(std::move(msg));
+                }
 
-                    // Pass to message handler
-                    OnMessage(msg.remote, msg.msg);
+                // Process as many messages, deficit round robin over the clients
+                size_t nMessageCount = 0;
+                while (nMessageCount < nMaxMessages && !m_lstInbound.empty()) {
+                    auto itClient = m_lstInbound.begin();
+                    inbound_client &client = *itClient;
+                    client.nDeficit += m_nInboundQuantum;
+
+                    while (nMessageCount < nMaxMessages && !client.deqMessages.empty()) {
+                        size_t nCost = sizeof(owned_message<T>) + client.deqMessages.front().msg.size();
+                        if (nCost > client.nDeficit) break;
+                        client.nDeficit -= nCost;
+
+                        owned_message<T> msg = std::move(client.deqMessages.front());
+                        client.deqMessages.pop_front();
+
+                        // The message is handled now, let its connection read again if it was waiting for memory
+                        if (msg.remote)
+                            msg.remote->ReleaseMemory(msg.msg);
+
+                        // Pass to message handler, timing the wait in the queue and the handler if it is traced
+                        uint32_t nClient = msg.remote ? msg.remote->GetID() : 0;
+                        if (msg.trace)
+                            m_tracer.Record(trace_stage::inbound_queue, nClient, msg.trace);
+                        OnMessage(msg.remote, msg.msg);
+                        if (msg.trace)
+                            m_tracer.Record(trace_stage::handler, nClient, msg.trace);
+
+                        nMessageCount++;
+                    }
 
-                    nMessageCount++;
+                    if (client.deqMessages.empty()) {
+                        m_mapInbound.erase(client.pClient);
+                        m_lstInbound.erase(itClient);
+                    } else if (nMessageCount < nMaxMessages) {
+                        // Its quantum is used up, next client
+                        m_lstInbound.splice(m_lstInbound.end(), m_lstInbound, itClient);
+                    }
                 }
             }
 
@@ -153,6 +404,20 @@ namespace bsl {
                 return true;
             }
 
+            // Called when a client wants to connect, call fnAdmit with true to accept it. It may be called later and
+            // from any thread, e.g. once a slow auth check is done, the server goes on accepting meanwhile. Nothing
+            // is read from the client until then, except with sessions enabled its wire format and session. Must be
+            // called before the server stops. Asks OnClientConnect() by default
+            virtual void OnClientConnectAsync(std::shared_ptr<connection<T>> client, std::function<void(bool)> fnAdmit) {
+                fnAdmit(OnClientConnect(client));
+            }
+
+            // Called instead of OnClientConnect when a client resumed its session on a new connection. It is admitted
+            // already and has the id of the connection it had before, which is gone without OnClientDisconnect()
+            virtual void OnClientResumed(std::shared_ptr<connection<T>> client) {
+
+            }
+
             // Called when a client appears to have disconnected
             virtual void OnClientDisconnect(std::shared_ptr<connection<T>> client) {
 
@@ -164,22 +429,194 @@ namespace bsl {
             }
 
 
+        private:
+            // Create a connection to handle the client, in memory left by an earlier one, and ask whether to admit it
+            void OnAccepted(asio::ip::tcp::socket socket) {
+                m_nAccepted.fetch_add(1, std::memory_order_relaxed);
+                if (m_bLogConnections) {
+                    std::error_code ec;
+                    std::cout << "[SERVER] New Connection: " << socket.remote_endpoint(ec) << "\n";
+                }
+
+                std::shared_ptr<connection<T>> newconn =
+                        std::allocate_shared<connection<T>>(pool_allocator<connection<T>>(m_pConnectionPool),
+                                                            connection<T>::owner::server,
+                                                            m_asioContext, std::move(socket),
+                                                            m_qMessagesIn);
+                newconn->SetMemoryBudget(&m_memoryBudget, &m_frameLimits);
+                newconn->SetRateLimits(&m_rateLimits);
+                newconn->SetLanePolicy(&m_lanePolicy);
+                newconn->SetCapture(&m_capture);
+                newconn->SetTracer(&m_tracer);
+                if (m_busyPoll.Enabled())
+                    newconn->SetBusyPoll(&m_busyPoll);
+                newconn->SetWireFormat(m_wireFormat);
+                if (m_sessions.Enabled())
+                    newconn->SetSessionTable(&m_sessions);
+#ifdef BSL_NET_TLS
+                if (m_tlsContext)
+                    newconn->EnableTls(m_tlsContext->Native());
+#endif
+
+                // A client resuming its session was admitted before, so sessions are settled before asking
+                if (m_sessions.Enabled()) {
+                    newconn->NegotiateSession([this](std::shared_ptr<connection<T>> conn, bool bResumed) {
+                        bool bOpen = conn->IsConnected();
+                        asio::post(m_asioContext,
+                                   [this, conn, bResumed, bOpen]() { OnNegotiated(conn, bResumed, bOpen); });
+                    });
+                    return;
+                }
+                AskAdmission(std::move(newconn));
+            }
+
+            void AskAdmission(std::shared_ptr<connection<T>> newconn) {
+                // The decision may come from another thread, the connection is added on the context's thread
+                OnClientConnectAsync(newconn, [this, newconn](bool bAdmit) {
+                    asio::post(m_asioContext, [this, newconn, bAdmit]() { Admit(newconn, bAdmit); });
+                });
+            }
+
+            // The client settled its session. A resumed one is the client it was before, a new one is asked about
+            void OnNegotiated(std::shared_ptr<connection<T>> newconn, bool bResumed, bool bOpen) {
+                if (!bOpen) {
+                    m_nDropped++;
+                } else if (!bResumed) {
+                    AskAdmission(std::move(newconn));
+                } else {
+                    m_nAdmitted++;
+                    m_deqConnections.push_back(newconn);
+                    if (m_bLogConnections)
+                        std::cout << "[" << newconn->GetID() << "] Connection Resumed\n";
+                    OnClientResumed(std::move(newconn));
+                }
+            }
+
+            void Admit(std::shared_ptr<connection<T>> newconn, bool bAdmit) {
+                if (bAdmit) {
+                    m_nAdmitted++;
+
+                    // Connection allowed, so add to connection container
+                    m_deqConnections.push_back(std::move(newconn));
+
+                    // Set the asio context to read of the header from the client
+                    m_deqConnections.back()->ConnectToClient(nIDCounter++);
+
+                    if (m_bLogConnections)
+                        std::cout << "[" << m_deqConnections.back()->GetID() << "] Connection Approved\n";
+                } else {
+                    m_nDenied++;
+                    if (m_bLogConnections)
+                        std::cout << "[-----] Connection Denied\n";
+                }
+            }
+
+            // Close an accept rate window every ACCEPT_RATE_WINDOW, and turn its accepts into a rate per second
+            void MeasureAcceptRate() {
+                m_timerAcceptRate.expires_after(ACCEPT_RATE_WINDOW);
+                m_timerAcceptRate.async_wait([this](std::error_code ec) {
+                    if (ec) return;
+
+                    auto tNow = std::chrono::steady_clock::now();
+                    uint64_t nAccepted = m_nAccepted.load(std::memory_order_relaxed);
+                    uint64_t nRate = uint64_t(double(nAccepted - m_nRateWindowStart) /
+                                              std::chrono::duration<double>(tNow - m_tRateWindow).count());
+                    m_nAcceptRate.store(nRate, std::memory_order_relaxed);
+                    if (nRate > m_nPeakAcceptRate.load(std::memory_order_relaxed))
+                        m_nPeakAcceptRate.store(nRate, std::memory_order_relaxed);
+                    m_tRateWindow = tNow;
+                    m_nRateWindowStart = nAccepted;
+
+                    MeasureAcceptRate();
+                });
+            }
+
+            // Forget timed out sessions every SESSION_EXPIRE_INTERVAL, also while no client connects
+            void ExpireSessions() {
+                m_timerSessions.expires_after(SESSION_EXPIRE_INTERVAL);
+                m_timerSessions.async_wait([this](std::error_code ec) {
+                    if (ec) return;
+                    m_sessions.Expire();
+                    ExpireSessions();
+                });
+            }
+
         protected:
+            // Asio context and thread that run the context. Connections and their strands belong to the context,
+            // so it is declared first to be destroyed after all of them
+            asio::io_context m_asioContext;
+            std::thread m_threadContext;
+
+            // Inbound memory limits, they outlive every connection referring to them
+            memory_budget m_memoryBudget;
+            frame_limits<T> m_frameLimits;
+
+            // Inbound rate limits, shared by all connections like the memory limits
+            rate_limits<T> m_rateLimits;
+
+            // Outbound lanes configuration shared by all connections
+            lane_policy<T> m_lanePolicy;
+
+            // Traffic capture, idle until StartCapture()
+            capture_writer m_capture;
+
+            // Pipeline tracing, idle until StartTrace()
+            tracer m_tracer;
+
+            // Low latency mode, off unless SetBusyPoll()
+            busy_poll m_busyPoll;
+
+            // Highest wire format clients may negotiate
+            wire_format m_wireFormat = wire_format::legacy;
+
+#ifdef BSL_NET_TLS
+            // Shared by all TLS connections, and home of the server's session cache
+            std::unique_ptr<tls_server_context> m_tlsContext;
+#endif
+
             // Thread Safe Queue for incoming message packets
             tsqueue<owned_message<T>> m_qMessagesIn;
 
+            // Messages taken off the incoming queue by client, in the order the clients take turns in Update(). A
+            // client is its session if it has one, its connection otherwise
+            struct inbound_client {
+                const void *pClient;
+                std::deque<owned_message<T>> deqMessages;
+                size_t nDeficit = 0;
+            };
+            std::list<inbound_client> m_lstInbound;
+            std::unordered_map<const void *, typename std::list<inbound_client>::iterator> m_mapInbound;
+            size_t m_nInboundQuantum = DEFAULT_INBOUND_QUANTUM;
+
+            // Sessions of clients, they may outlive the connections
+            session_table<T> m_sessions;
+            asio::steady_timer m_timerSessions{m_asioContext};
+
+            // Memory of disconnected clients, reused for new ones
+            std::shared_ptr<block_pool> m_pConnectionPool = std::make_shared<block_pool>();
+
             // Container of active validated connections
             std::deque<std::shared_ptr<connection<T>>> m_deqConnections;
 
-            // Asio context and thread that run the context
-            asio::io_context m_asioContext;
-            std::thread m_threadContext;
-
             // Acceptor handles new incoming connection
             asio::ip::tcp::acceptor m_asioAcceptor;
 
             // Clients will be identified by this ID
             uint32_t nIDCounter = 10000;
+
+            // Accept path: outstanding accepts, logging and counters. The rate window is only used by its timer
+            size_t m_nAcceptConcurrency = 1;
+            bool m_bLogConnections = true;
+            std::atomic<uint64_t> m_nAccepted{0};
+            std::atomic<uint64_t> m_nAdmitted{0};
+            std::atomic<uint64_t> m_nDenied{0};
+            std::atomic<uint64_t> m_nDropped{0};
+            std::atomic<uint64_t> m_nAcceptErrors{0};
+            std::atomic<uint64_t> m_nAcceptRate{0};
+            std::atomic<uint64_t> m_nPeakAcceptRate{0};
+            asio::steady_timer m_timerAcceptRate{m_asioContext};
+            std::chrono::steady_clock::time_point m_tRateWindow;
+            uint64_t m_nRateWindowStart = 0;
         };
     }
 }
\ No newline at end of file
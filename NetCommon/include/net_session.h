@@ -0,0 +1,307 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+#include "net_memory.h"
+#include "net_priority.h"
+
+namespace bsl {
+    namespace net {
+        // Bytes of sent messages a session keeps until the remote acknowledges them. On a server they are charged to
+        // its memory budget as well, all sessions together keep no more than it has left
+        constexpr size_t DEFAULT_REPLAY_BYTES = 4 * 1024 * 1024;
+
+        // How long the server keeps a session nobody is connected to, for its client to come back
+        constexpr std::chrono::seconds DEFAULT_SESSION_TIMEOUT{30};
+
+        // How often the server looks for sessions that timed out
+        constexpr std::chrono::seconds SESSION_EXPIRE_INTERVAL{1};
+
+        // Acks ride along with outgoing messages. A connection with nothing to send acknowledges on its own once
+        // this many messages are unacknowledged, or this long after the first one arrived
+        constexpr uint64_t SESSION_ACK_BATCH = 32;
+        constexpr std::chrono::milliseconds SESSION_ACK_DELAY{20};
+
+        // What a session remembers across connections: how many messages went each way, the sent ones the remote
+        // hasn't acknowledged, and those a connection didn't get to send before it went away. Messages are
+        // numbered from 1 in the order they are written. One connection owns the session at a time and calls of
+        // any other one are ignored, they run on different strands so the state is locked
+        template<typename T>
+        class session {
+        public:
+            // What a connection taking over the session has to send before anything new
+            struct handover {
+                // Sent before, but the remote didn't receive them
+                std::deque<message<T>> deqReplay;
+                // Never sent, with the lanes they were queued in
+                std::deque<std::pair<message<T>, priority>> deqUnsent;
+                // The owner before, it has to be closed if it is still connected
+                std::shared_ptr<connection<T>> pPrevious;
+                // Messages this side received, the remote resumes after them
+                uint64_t nReceived = 0;
+            };
+
+            // Replay buffers of server sessions are charged to pBudget, client sessions have none
+            session(uint64_t nToken, uint32_t nId, size_t nMaxReplayBytes, memory_budget *pBudget = nullptr)
+                    : m_nToken(nToken), m_nId(nId), m_nMaxReplayBytes(nMaxReplayBytes), m_pBudget(pBudget) {}
+
+            session(const session<T> &) = delete;
+
+        public:
+            uint64_t Token() const {
+                std::scoped_lock lock(m_muxSession);
+                return m_nToken;
+            }
+
+            // Id of the connection that started the session, the ones resuming it take it over
+            uint32_t Id() const {
+                return m_nId;
+            }
+
+            uint64_t Received() const {
+                std::scoped_lock lock(m_muxSession);
+                return m_nReceived;
+            }
+
+            // The server didn't know the session, start over as the new one it gave. Everything of the old one is lost
+            void Reset(uint64_t nToken) {
+                std::scoped_lock lock(m_muxSession);
+                m_nToken = nToken;
+                m_nReceived = m_nSent = m_nAcked = 0;
+                ClearReplayLocked();
+                m_deqUnsent.clear();
+            }
+
+            // The session is forgotten, drop what it kept for the client and return it to the memory budget
+            void Close() {
+                std::scoped_lock lock(m_muxSession);
+                ClearReplayLocked();
+                m_deqUnsent.clear();
+            }
+
+            // Make pConnection the owner, the remote got nRemoteReceived messages so far. Fails if the remote
+            // claims more than was sent, or if messages it is missing already fell out of the replay buffer
+            bool Attach(const std::shared_ptr<connection<T>> &pConnection, uint64_t nRemoteReceived, handover &out) {
+                std::scoped_lock lock(m_muxSession);
+                if (nRemoteReceived > m_nSent || nRemoteReceived < m_nAcked)
+                    return false;
+
+                AckLocked(nRemoteReceived);
+                out.deqReplay.assign(m_deqReplay.begin(), m_deqReplay.end());
+                out.deqUnsent = std::move(m_deqUnsent);
+                m_deqUnsent.clear();
+                out.pPrevious = m_wpOwner.lock();
+                out.nReceived = m_nReceived;
+
+                m_wpOwner = pConnection;
+                m_pOwner = pConnection.get();
+                return true;
+            }
+
+            // The connection that owns the session, null while there is none
+            std::shared_ptr<connection<T>> Owner() const {
+                std::scoped_lock lock(m_muxSession);
+                return m_wpOwner.lock();
+            }
+
+            // pConnection is about to write msg, keep a copy until it is acknowledged. The oldest messages are
+            // dropped when the buffer is full or the memory budget is used up, the session can't be resumed from
+            // before them anymore. Returns false if pConnection doesn't own the session anymore, the message then
+            // goes to the new owner instead
+            bool Sent(const connection<T> *pConnection, const message<T> &msg) {
+                std::scoped_lock lock(m_muxSession);
+                if (pConnection != m_pOwner) return false;
+
+                m_nSent++;
+                size_t nCost = Cost(msg);
+                while (!m_deqReplay.empty() && m_nReplayBytes + nCost > m_nMaxReplayBytes)
+                    DropOldestLocked();
+
+                bool bCharged = !m_pBudget || m_pBudget->TryAcquire(nCost);
+                while (!bCharged && !m_deqReplay.empty()) {
+                    DropOldestLocked();
+                    bCharged = m_pBudget->TryAcquire(nCost);
+                }
+                // Not even the message itself fits, it is sent without a copy and nothing before it can be resumed
+                if (!bCharged) {
+                    m_nAcked = m_nSent;
+                    return true;
+                }
+
+                m_deqReplay.push_back(msg);
+                m_nReplayBytes += nCost;
+                return true;
+            }
+
+            // Held while a connection of the session decides whether to queue a message itself, and while it stops
+            // doing that, so nothing is queued on a connection after it handed its queue over
+            std::mutex &SendMutex() {
+                return m_muxSend;
+            }
+
+            // A message sent to pConnection after it left the session. Returns the owner to send it, while there is
+            // none it waits for the next connection like the unsent ones
+            std::shared_ptr<connection<T>> Forward(const connection<T> *pConnection, const message<T> &msg, priority lane) {
+                std::scoped_lock lock(m_muxSession);
+                auto pOwner = m_wpOwner.lock();
+                if (pOwner && pOwner.get() != pConnection) return pOwner;
+                m_deqUnsent.emplace_back(msg, lane);
+                return nullptr;
+            }
+
+            // The remote received nCount messages in total
+            void Acked(const connection<T> *pConnection, uint64_t nCount) {
+                std::scoped_lock lock(m_muxSession);
+                if (pConnection == m_pOwner)
+                    AckLocked(std::min(nCount, m_nSent));
+            }
+
+            // A message arrived at pConnection, returns how many arrived in total. Returns 0 if pConnection doesn't
+            // own the session anymore, the message must be dropped as the remote sends it to the new owner again
+            uint64_t Received(const connection<T> *pConnection) {
+                std::scoped_lock lock(m_muxSession);
+                return pConnection == m_pOwner ? ++m_nReceived : 0;
+            }
+
+            // pConnection is going away with messages it didn't send. The owner keeps them for the next connection,
+            // one that was superseded passes them on to the connection that resumed the session
+            void Detach(const connection<T> *pConnection, std::deque<std::pair<message<T>, priority>> deqUnsent) {
+                std::shared_ptr<connection<T>> pOwner;
+                {
+                    std::scoped_lock lock(m_muxSession);
+                    if (pConnection == m_pOwner) {
+                        // Anything already here was sent after the connection closed, so it goes after its own
+                        m_deqUnsent.insert(m_deqUnsent.begin(), std::make_move_iterator(deqUnsent.begin()),
+                                           std::make_move_iterator(deqUnsent.end()));
+                        m_wpOwner.reset();
+                        m_pOwner = nullptr;
+                        m_tDetached = std::chrono::steady_clock::now();
+                        return;
+                    }
+                    pOwner = m_wpOwner.lock();
+                }
+
+                if (pOwner && !deqUnsent.empty())
+                    pOwner->Requeue(std::move(deqUnsent));
+            }
+
+            // True if no connection has owned the session for longer than timeout
+            bool Expired(std::chrono::steady_clock::time_point tNow, std::chrono::steady_clock::duration timeout) const {
+                std::scoped_lock lock(m_muxSession);
+                return !m_pOwner && tNow - m_tDetached > timeout;
+            }
+
+        private:
+            static size_t Cost(const message<T> &msg) {
+                return sizeof(message<T>) + msg.body.size();
+            }
+
+            void AckLocked(uint64_t nCount) {
+                while (m_nAcked < nCount && !m_deqReplay.empty())
+                    DropOldestLocked();
+            }
+
+            void DropOldestLocked() {
+                size_t nCost = Cost(m_deqReplay.front());
+                m_deqReplay.pop_front();
+                m_nReplayBytes -= nCost;
+                m_nAcked++;
+                if (m_pBudget)
+                    m_pBudget->Release(nCost);
+            }
+
+            void ClearReplayLocked() {
+                m_deqReplay.clear();
+                if (m_pBudget)
+                    m_pBudget->Release(m_nReplayBytes);
+                m_nReplayBytes = 0;
+            }
+
+        private:
+            mutable std::mutex m_muxSession;
+            std::mutex m_muxSend;
+
+            uint64_t m_nToken;
+            const uint32_t m_nId;
+            const size_t m_nMaxReplayBytes;
+            memory_budget *const m_pBudget;
+
+            // Messages received, sent, and sent but acknowledged or dropped. The replay buffer holds the ones
+            // numbered m_nAcked + 1 to m_nSent
+            uint64_t m_nReceived = 0;
+            uint64_t m_nSent = 0;
+            uint64_t m_nAcked = 0;
+            std::deque<message<T>> m_deqReplay;
+            size_t m_nReplayBytes = 0;
+            std::deque<std::pair<message<T>, priority>> m_deqUnsent;
+
+            // The owning connection, the raw pointer identifies it even while it is being destroyed
+            std::weak_ptr<connection<T>> m_wpOwner;
+            const connection<T> *m_pOwner = nullptr;
+            std::chrono::steady_clock::time_point m_tDetached = std::chrono::steady_clock::now();
+        };
+
+        // The sessions of a server by token. Sessions nobody is connected to are forgotten after the timeout
+        template<typename T>
+        class session_table {
+        public:
+            // Replay buffers of the sessions are charged to pBudget, which has to outlive the table
+            void Configure(size_t nMaxReplayBytes, std::chrono::seconds timeout, memory_budget *pBudget) {
+                m_nMaxReplayBytes = nMaxReplayBytes;
+                m_timeout = timeout;
+                m_pBudget = pBudget;
+                m_bEnabled = true;
+            }
+
+            bool Enabled() const {
+                return m_bEnabled;
+            }
+
+            std::shared_ptr<session<T>> Find(uint64_t nToken) {
+                std::scoped_lock lock(m_muxTable);
+                auto it = m_mapSessions.find(nToken);
+                return it != m_mapSessions.end() ? it->second : nullptr;
+            }
+
+            // A new session with an unguessable token, so a client can only resume its own
+            std::shared_ptr<session<T>> Create(uint32_t nId) {
+                std::scoped_lock lock(m_muxTable);
+                uint64_t nToken = 0;
+                while (nToken == 0 || m_mapSessions.count(nToken))
+                    nToken = (uint64_t(m_random()) << 32) | m_random();
+
+                auto pSession = std::make_shared<session<T>>(nToken, nId, m_nMaxReplayBytes, m_pBudget);
+                m_mapSessions.emplace(nToken, pSession);
+                return pSession;
+            }
+
+            size_t Count() const {
+                std::scoped_lock lock(m_muxTable);
+                return m_mapSessions.size();
+            }
+
+            // Forget the sessions nobody has been connected to for longer than the timeout
+            void Expire() {
+                std::scoped_lock lock(m_muxTable);
+                auto tNow = std::chrono::steady_clock::now();
+                for (auto it = m_mapSessions.begin(); it != m_mapSessions.end();) {
+                    if (it->second->Expired(tNow, m_timeout)) {
+                        it->second->Close();
+                        it = m_mapSessions.erase(it);
+                    } else
+                        ++it;
+                }
+            }
+
+        private:
+            mutable std::mutex m_muxTable;
+            std::unordered_map<uint64_t, std::shared_ptr<session<T>>> m_mapSessions;
+            std::random_device m_random;
+
+            size_t m_nMaxReplayBytes = DEFAULT_REPLAY_BYTES;
+            std::chrono::seconds m_timeout = DEFAULT_SESSION_TIMEOUT;
+            memory_budget *m_pBudget = nullptr;
+            bool m_bEnabled = false;
+        };
+    }
+}
@@ -0,0 +1,188 @@
+#pragma once
+
+#include "net_common.h"
+
+#ifdef BSL_NET_TLS
+
+#include <asio/ssl.hpp>
+
+namespace bsl {
+    namespace net {
+        // Settings of the optional TLS transport. Certificates can be given as files or as PEM text
+        struct tls_config {
+            std::string sCertificateFile;
+            std::string sPrivateKeyFile;
+            std::string sCertificatePem;
+            std::string sPrivateKeyPem;
+
+            // Trusted certificates used to verify the remote. By default nothing is verified: the connection is
+            // encrypted, but a client talks to whoever answers. With bVerifyPeer a client also checks that the
+            // certificate was issued for the host it connects to
+            std::string sVerifyFile;
+            bool bVerifyPeer = false;
+
+            // Cipher list for TLS 1.2 and cipher suites for TLS 1.3, an empty string keeps the OpenSSL defaults
+            std::string sCipherList;
+            std::string sCipherSuites;
+
+            // Sessions the server remembers for resumption, and whether it also hands out stateless tickets
+            size_t nSessionCacheSize = 20 * 1024;
+            bool bSessionTickets = true;
+        };
+
+        // Apply the parts of the config shared by both sides
+        inline void tls_configure_context(asio::ssl::context &ctx, const tls_config &config) {
+            ctx.set_options(asio::ssl::context::default_workarounds |
+                            asio::ssl::context::no_sslv2 |
+                            asio::ssl::context::no_sslv3 |
+                            asio::ssl::context::no_tlsv1 |
+                            asio::ssl::context::no_tlsv1_1);
+
+            if (!config.sCertificateFile.empty())
+                ctx.use_certificate_chain_file(config.sCertificateFile);
+            else if (!config.sCertificatePem.empty())
+                ctx.use_certificate_chain(asio::buffer(config.sCertificatePem));
+
+            if (!config.sPrivateKeyFile.empty())
+                ctx.use_private_key_file(config.sPrivateKeyFile, asio::ssl::context::pem);
+            else if (!config.sPrivateKeyPem.empty())
+                ctx.use_private_key(asio::buffer(config.sPrivateKeyPem), asio::ssl::context::pem);
+
+            if (!config.sVerifyFile.empty())
+                ctx.load_verify_file(config.sVerifyFile);
+            ctx.set_verify_mode(config.bVerifyPeer ? asio::ssl::verify_peer : asio::ssl::verify_none);
+
+            if (!config.sCipherList.empty() &&
+                SSL_CTX_set_cipher_list(ctx.native_handle(), config.sCipherList.c_str()) != 1)
+                throw std::runtime_error("Invalid TLS cipher list: " + config.sCipherList);
+
+            if (!config.sCipherSuites.empty() &&
+                SSL_CTX_set_ciphersuites(ctx.native_handle(), config.sCipherSuites.c_str()) != 1)
+                throw std::runtime_error("Invalid TLS cipher suites: " + config.sCipherSuites);
+        }
+
+        // Tell the server which host a client connects to, for servers with a certificate per name, and with
+        // verification enabled only accept a certificate issued for it. An IP address is checked against the
+        // addresses in the certificate, and isn't sent as a name
+        inline void tls_set_host(SSL *ssl, const std::string &sHost) {
+            std::error_code ec;
+            asio::ip::make_address(sHost, ec);
+            bool bAddress = !ec;
+
+            if (!bAddress)
+                SSL_set_tlsext_host_name(ssl, sHost.c_str());
+
+            if (SSL_get_verify_mode(ssl) & SSL_VERIFY_PEER) {
+                if (bAddress)
+                    X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), sHost.c_str());
+                else
+                    SSL_set1_host(ssl, sHost.c_str());
+            }
+        }
+
+        // Server side TLS context, keeps a session cache and issues tickets so reconnecting clients skip the full handshake
+        class tls_server_context {
+        public:
+            explicit tls_server_context(const tls_config &config) : m_context(asio::ssl::context::tls_server) {
+                tls_configure_context(m_context, config);
+
+                SSL_CTX *ctx = m_context.native_handle();
+                static const unsigned char sessionIdContext[] = "bsl::net";
+                SSL_CTX_set_session_id_context(ctx, sessionIdContext, sizeof(sessionIdContext) - 1);
+                SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+                SSL_CTX_sess_set_cache_size(ctx, static_cast<long>(config.nSessionCacheSize));
+                if (!config.bSessionTickets)
+                    SSL_CTX_set_options(ctx, SSL_OP_NO_TICKET);
+            }
+
+            asio::ssl::context &Native() {
+                return m_context;
+            }
+
+        private:
+            asio::ssl::context m_context;
+        };
+
+        // Client side TLS context. Sessions handed out by servers are kept per "host:port", and offered again on
+        // the next connection to the same server
+        class tls_client_context {
+        public:
+            explicit tls_client_context(const tls_config &config) : m_context(asio::ssl::context::tls_client) {
+                tls_configure_context(m_context, config);
+
+                SSL_CTX *ctx = m_context.native_handle();
+                SSL_CTX_set_ex_data(ctx, ContextIndex(), this);
+
+                // OpenSSL tells us about every new session, including TLS 1.3 tickets that arrive after the handshake
+                SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+                SSL_CTX_sess_set_new_cb(ctx, &tls_client_context::OnNewSession);
+            }
+
+            tls_client_context(const tls_client_context &) = delete;
+
+            ~tls_client_context() {
+                for (auto &session : m_mapSessions)
+                    SSL_SESSION_free(session.second);
+            }
+
+            asio::ssl::context &Native() {
+                return m_context;
+            }
+
+            // Prepare a connection to the server known as sKey, offering a saved session when there is one.
+            // sKey must stay alive as long as the SSL object
+            void Attach(SSL *ssl, const std::string &sKey) {
+                SSL_set_ex_data(ssl, SessionKeyIndex(), const_cast<std::string *>(&sKey));
+
+                std::scoped_lock lock(m_muxSessions);
+                auto it = m_mapSessions.find(sKey);
+                if (it != m_mapSessions.end())
+                    SSL_set_session(ssl, it->second);
+            }
+
+            // Forget the session of a server, e.g. after it rejected the resumption
+            void Forget(const std::string &sKey) {
+                std::scoped_lock lock(m_muxSessions);
+                auto it = m_mapSessions.find(sKey);
+                if (it != m_mapSessions.end()) {
+                    SSL_SESSION_free(it->second);
+                    m_mapSessions.erase(it);
+                }
+            }
+
+        private:
+            static int OnNewSession(SSL *ssl, SSL_SESSION *session) {
+                auto *self = static_cast<tls_client_context *>(
+                        SSL_CTX_get_ex_data(SSL_get_SSL_CTX(ssl), ContextIndex()));
+                auto *sKey = static_cast<std::string *>(SSL_get_ex_data(ssl, SessionKeyIndex()));
+                if (!self || !sKey) return 0;
+
+                std::scoped_lock lock(self->m_muxSessions);
+                SSL_SESSION *&slot = self->m_mapSessions[*sKey];
+                if (slot) SSL_SESSION_free(slot);
+                slot = session;
+
+                // Returning 1 means we took over the reference to the session
+                return 1;
+            }
+
+            static int ContextIndex() {
+                static int index = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+                return index;
+            }
+
+            static int SessionKeyIndex() {
+                static int index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+                return index;
+            }
+
+        private:
+            asio::ssl::context m_context;
+
+            std::mutex m_muxSessions;
+            std::unordered_map<std::string, SSL_SESSION *> m_mapSessions;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,231 @@
+#pragma once
+
+#include "net_common.h"
+
+#include <fstream>
+
+namespace bsl {
+    namespace net {
+        // Stages a message goes through. Inbound: read is from its header to its complete body, including waits
+        // for the rate limits and the memory budget, then it waits in the inbound queue until Update() takes it,
+        // then the handler runs. Outbound: it waits in the lanes from Send() until its write starts, then the write
+        // until its completion
+        enum class trace_stage : uint8_t {
+            read,
+            inbound_queue,
+            handler,
+            outbound_queue,
+            write
+        };
+
+        constexpr size_t TRACE_STAGES = 5;
+
+        inline const char *trace_stage_name(trace_stage stage) {
+            static const char *aNames[TRACE_STAGES] = {"read", "inbound_queue", "handler", "outbound_queue", "write"};
+            return aNames[size_t(stage)];
+        }
+
+        // Travels with a sampled message from stage to stage: its trace number, 0 when it isn't sampled, and
+        // when its current stage began
+        struct trace_mark {
+            uint64_t nTrace = 0;
+            int64_t tStage = 0;
+
+            explicit operator bool() const {
+                return nTrace != 0;
+            }
+        };
+
+        // Latencies in nanoseconds, in buckets that are 1/8 of a power of two wide, so percentiles are at most
+        // 12.5% too high. Lock free, any thread may record
+        class latency_histogram {
+        public:
+            void Record(int64_t nNanoseconds) {
+                uint64_t n = uint64_t(std::max<int64_t>(nNanoseconds, 0));
+                m_aCounts[Bucket(n)].fetch_add(1, std::memory_order_relaxed);
+                m_nCount.fetch_add(1, std::memory_order_relaxed);
+
+                uint64_t nMax = m_nMax.load(std::memory_order_relaxed);
+                while (n > nMax && !m_nMax.compare_exchange_weak(nMax, n, std::memory_order_relaxed));
+            }
+
+            uint64_t Count() const {
+                return m_nCount.load(std::memory_order_relaxed);
+            }
+
+            uint64_t Max() const {
+                return m_nMax.load(std::memory_order_relaxed);
+            }
+
+            // Upper bound of the bucket dPercentile of the recorded latencies fall in
+            uint64_t Percentile(double dPercentile) const {
+                uint64_t nCount = Count();
+                if (nCount == 0) return 0;
+
+                uint64_t nRank = std::max<uint64_t>(1, uint64_t(dPercentile / 100.0 * double(nCount) + 0.5));
+                uint64_t nSeen = 0;
+                for (size_t i = 0; i < BUCKETS; i++) {
+                    nSeen += m_aCounts[i].load(std::memory_order_relaxed);
+                    if (nSeen >= nRank) return std::min(UpperBound(i), Max());
+                }
+                return Max();
+            }
+
+            void Clear() {
+                for (auto &nCount : m_aCounts)
+                    nCount.store(0, std::memory_order_relaxed);
+                m_nCount.store(0, std::memory_order_relaxed);
+                m_nMax.store(0, std::memory_order_relaxed);
+            }
+
+        private:
+            static constexpr size_t SUB_BITS = 3;
+            static constexpr size_t SUB_BUCKETS = size_t(1) << SUB_BITS;
+            static constexpr size_t BUCKETS = (64 - SUB_BITS + 1) * SUB_BUCKETS;
+
+            // Values below 8 have a bucket each, above that the top bit picks the power of two and the 3 bits
+            // below it the sub bucket
+            static size_t Bucket(uint64_t n) {
+                if (n < SUB_BUCKETS) return size_t(n);
+                size_t nTop = 63;
+                while (!(n >> nTop)) nTop--;
+                size_t nSub = size_t(n >> (nTop - SUB_BITS)) & (SUB_BUCKETS - 1);
+                return (nTop - SUB_BITS + 1) * SUB_BUCKETS + nSub;
+            }
+
+            static uint64_t UpperBound(size_t nBucket) {
+                if (nBucket < SUB_BUCKETS) return nBucket;
+                size_t nShift = nBucket / SUB_BUCKETS - 1;
+                uint64_t nLower = uint64_t(SUB_BUCKETS + nBucket % SUB_BUCKETS) << nShift;
+                return nLower + ((uint64_t(1) << nShift) - 1);
+            }
+
+        private:
+            std::array<std::atomic<uint64_t>, BUCKETS> m_aCounts{};
+            std::atomic<uint64_t> m_nCount{0};
+            std::atomic<uint64_t> m_nMax{0};
+        };
+
+        // Samples 1 of every n messages and times them through the stages, into a histogram per stage and a
+        // ring of the latest spans that can be written out for chrome://tracing or Perfetto. While disabled
+        // Sample() is a single relaxed load, nothing else runs
+        class tracer {
+        public:
+            tracer() = default;
+
+            tracer(const tracer &) = delete;
+
+        public:
+            void Enable(uint32_t nSampleEvery = 100, size_t nMaxSpans = 100000) {
+                {
+                    std::scoped_lock lock(m_muxSpans);
+                    m_vSpans.clear();
+                    m_vSpans.reserve(nMaxSpans);
+                    m_nMaxSpans = nMaxSpans;
+                    m_nNextSpan = 0;
+                }
+                for (auto &histogram : m_aHistograms)
+                    histogram.Clear();
+                m_nSampleEvery.store(std::max<uint32_t>(nSampleEvery, 1));
+            }
+
+            void Disable() {
+                m_nSampleEvery.store(0);
+            }
+
+            bool Enabled() const {
+                return m_nSampleEvery.load(std::memory_order_relaxed) != 0;
+            }
+
+            // A mark for the next message, it is only set if the message is sampled. Its first stage starts now
+            trace_mark Sample() {
+                uint32_t nEvery = m_nSampleEvery.load(std::memory_order_relaxed);
+                if (nEvery == 0) return {};
+
+                uint64_t nMessage = m_nMessages.fetch_add(1, std::memory_order_relaxed);
+                if (nMessage % nEvery != 0) return {};
+                return {nMessage / nEvery + 1, Now()};
+            }
+
+            // The stage of a sampled message ended at tEnd, the next one starts there
+            void Record(trace_stage stage, uint32_t nConnection, trace_mark &mark, int64_t tEnd = Now()) {
+                m_aHistograms[size_t(stage)].Record(tEnd - mark.tStage);
+
+                {
+                    std::scoped_lock lock(m_muxSpans);
+                    span s{mark.nTrace, mark.tStage, tEnd, nConnection, stage};
+                    if (m_vSpans.size() < m_nMaxSpans) {
+                        m_vSpans.push_back(s);
+                    } else if (m_nMaxSpans) {
+                        m_vSpans[m_nNextSpan] = s;
+                        m_nNextSpan = (m_nNextSpan + 1) % m_nMaxSpans;
+                    }
+                }
+                mark.tStage = tEnd;
+            }
+
+            const latency_histogram &Histogram(trace_stage stage) const {
+                return m_aHistograms[size_t(stage)];
+            }
+
+            // One line per stage with samples: count and percentiles in microseconds
+            void Report(std::ostream &os) const {
+                for (size_t i = 0; i < TRACE_STAGES; i++) {
+                    auto &histogram = m_aHistograms[i];
+                    if (histogram.Count() == 0) continue;
+                    os << trace_stage_name(trace_stage(i)) << ": " << histogram.Count() << " samples, us p50 "
+                       << histogram.Percentile(50) / 1e3 << ", p90 " << histogram.Percentile(90) / 1e3
+                       << ", p99 " << histogram.Percentile(99) / 1e3 << ", max " << histogram.Max() / 1e3 << "\n";
+                }
+            }
+
+            // Write the spans as Chrome trace events. Each connection is a process, each traced message an async
+            // track on it, so the stages of one message line up even when messages overlap
+            bool WriteChromeTrace(const std::string &sPath) const {
+                std::ofstream file(sPath);
+                if (!file) return false;
+
+                std::scoped_lock lock(m_muxSpans);
+                int64_t tOrigin = INT64_MAX;
+                for (auto &s : m_vSpans)
+                    tOrigin = std::min(tOrigin, s.tStart);
+
+                file << "{\"traceEvents\":[";
+                bool bFirst = true;
+                for (auto &s : m_vSpans) {
+                    for (int64_t t : {s.tStart, s.tEnd}) {
+                        file << (bFirst ? "\n" : ",\n") << "{\"name\":\"" << trace_stage_name(s.stage)
+                             << "\",\"cat\":\"net\",\"ph\":\"" << (t == s.tStart ? 'b' : 'e') << "\",\"id\":" << s.nTrace
+                             << ",\"pid\":" << s.nConnection << ",\"tid\":0,\"ts\":" << double(t - tOrigin) / 1e3 << "}";
+                        bFirst = false;
+                    }
+                }
+                file << "\n],\"displayTimeUnit\":\"ns\"}\n";
+                return bool(file);
+            }
+
+            static int64_t Now() {
+                return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+            }
+
+        private:
+            struct span {
+                uint64_t nTrace;
+                int64_t tStart;
+                int64_t tEnd;
+                uint32_t nConnection;
+                trace_stage stage;
+            };
+
+            std::atomic<uint32_t> m_nSampleEvery{0};
+            std::atomic<uint64_t> m_nMessages{0};
+            std::array<latency_histogram, TRACE_STAGES> m_aHistograms;
+
+            mutable std::mutex m_muxSpans;
+            std::vector<span> m_vSpans;
+            size_t m_nMaxSpans = 0;
+            size_t m_nNextSpan = 0;
+        };
+    }
+}
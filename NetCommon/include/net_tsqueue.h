@@ -1,6 +1,7 @@
 #pragma once
 
 #include "net_common.h"
+#include "net_poll.h"
 
 namespace bsl {
     namespace net {
@@ -31,6 +32,7 @@ namespace bsl {
                 std::scoped_lock lock(muxQueue);
                 auto t = std::move(deqQueue.front());
                 deqQueue.pop_front();
+                nItems.store(deqQueue.size(), std::memory_order_relaxed);
                 return t;
             }
 
@@ -39,13 +41,28 @@ namespace bsl {
                 std::scoped_lock lock(muxQueue);
                 auto t = std::move(deqQueue.back());
                 deqQueue.pop_back();
+                nItems.store(deqQueue.size(), std::memory_order_relaxed);
                 return t;
             }
 
             // Adds an item to back of Queue
             void push_back(const T &item) {
-                std::scoped_lock lock(muxQueue);
-                deqQueue.emplace_back(std::move(item));
+                {
+                    std::scoped_lock lock(muxQueue);
+                    deqQueue.emplace_back(std::move(item));
+                    nItems.store(deqQueue.size(), std::memory_order_release);
+                }
+
+                std::unique_lock<std::mutex> ul(muxBlocking);
+                cvBlocking.notify_one();
+            }
+
+            void push_back(T &&item) {
+                {
+                    std::scoped_lock lock(muxQueue);
+                    deqQueue.emplace_back(std::move(item));
+                    nItems.store(deqQueue.size(), std::memory_order_release);
+                }
 
                 std::unique_lock<std::mutex> ul(muxBlocking);
                 cvBlocking.notify_one();
@@ -53,8 +70,11 @@ namespace bsl {
 
             // Adds an item to front of Queue
             void push_front(const T &item) {
-                std::scoped_lock lock(muxQueue);
-                deqQueue.emplace_front(std::move(item));
+                {
+                    std::scoped_lock lock(muxQueue);
+                    deqQueue.emplace_front(std::move(item));
+                    nItems.store(deqQueue.size(), std::memory_order_release);
+                }
 
                 std::unique_lock<std::mutex> ul(muxBlocking);
                 cvBlocking.notify_one();
@@ -76,18 +96,38 @@ namespace bsl {
             void clear() {
                 std::scoped_lock lock(muxQueue);
                 deqQueue.clear();
+                nItems.store(0, std::memory_order_relaxed);
             }
 
+            // Blocks until the queue has an item. The check happens under muxBlocking, which pushers take before
+            // notifying, so an item pushed right after the check can't slip through unnoticed
             void wait() {
-                while (empty()) {
-                    std::unique_lock<std::mutex> ul(muxBlocking);
-                    cvBlocking.wait(ul);
+                std::unique_lock<std::mutex> ul(muxBlocking);
+                cvBlocking.wait(ul, [this]() { return !empty(); });
+            }
+
+            // Like wait(), but first spins for up to spin watching the item count, which takes no lock. An item
+            // pushed within the spin is seen without the condition variable's wakeup
+            void wait(std::chrono::nanoseconds spin) {
+                if (spin.count() > 0) {
+                    auto tEnd = std::chrono::steady_clock::now() + spin;
+                    while (nItems.load(std::memory_order_acquire) == 0) {
+                        if (std::chrono::steady_clock::now() > tEnd) {
+                            wait();
+                            return;
+                        }
+                        spin_pause();
+                    }
+                    return;
                 }
+                wait();
             }
 
         protected:
             std::mutex muxQueue;
             std::deque<T> deqQueue;
+            // Size of deqQueue, updated under muxQueue, for spinning without it
+            std::atomic<size_t> nItems{0};
             std::condition_variable cvBlocking;
             std::mutex muxBlocking;
         };
@@ -0,0 +1,215 @@
+#pragma once
+
+#include "net_common.h"
+#include "net_message.h"
+
+namespace bsl {
+    namespace net {
+        // How message headers are put on the wire. legacy is the raw message header struct, in host byte order
+        // and with compiler padding, which is what peers without negotiation speak. compact is portable:
+        //   varint((id << 1) | has flags), [flags byte], varint(size)
+        // Varints are LEB128, 7 bits per byte least significant group first, so there is no byte order to agree
+        // on. Ids below 64 with bodies below 128 bytes take 2 bytes instead of 8
+        enum class wire_format : uint8_t {
+            legacy = 0,
+            compact = 1
+        };
+
+        // Header of peers that don't negotiate, laid out as message_header<T> was before it had flags
+        template<typename T>
+        struct legacy_header {
+            T id{};
+            uint32_t size = 0;
+        };
+
+        // A peer that negotiates sends this first, the server answers with the same 8 bytes carrying the version
+        // and features both will use. The magic can't be mistaken for a legacy header unless an id happens to spell it
+        struct wire_hello {
+            char magic[4] = {'B', 'S', 'L', 'W'};
+            uint8_t nVersion = 0;
+            uint8_t nFeatures = 0;
+            uint8_t reserved[2]{};
+        };
+
+        // How long a negotiating server waits for the hello. A legacy client that waits for the server to speak
+        // first never sends anything, after this the server speaks legacy to it. A negotiating client sends its
+        // hello as soon as it is connected, one that is slower than this fails negotiation
+        constexpr std::chrono::milliseconds HELLO_TIMEOUT{250};
+
+        // Features offered in the hello, peers that don't know one leave its bit at 0
+        constexpr uint8_t HELLO_FEATURE_SESSION = 1;
+
+        static_assert(sizeof(wire_hello) == 8, "The hello is sent as is");
+
+        // Longest compact header: a 64 bit id shifted by one, the flags and a 32 bit size
+        constexpr size_t COMPACT_HEADER_MAX = 10 + 1 + 5;
+
+        // Longest session header: the compact one with a 64 bit ack
+        constexpr size_t SESSION_HEADER_MAX = COMPACT_HEADER_MAX + 10;
+
+        inline size_t varint_encode(uint64_t nValue, uint8_t *p) {
+            size_t n = 0;
+            while (nValue >= 0x80) {
+                p[n++] = uint8_t(nValue) | 0x80;
+                nValue >>= 7;
+            }
+            p[n++] = uint8_t(nValue);
+            return n;
+        }
+
+        // Returns the bytes used, 0 if the varint doesn't end within n bytes and -1 if it is longer than nMaxBytes
+        inline int varint_decode(const uint8_t *p, size_t n, size_t nMaxBytes, uint64_t &nValue) {
+            nValue = 0;
+            for (size_t i = 0; i < nMaxBytes; i++) {
+                if (i == n) return 0;
+                nValue |= uint64_t(p[i] & 0x7f) << (7 * i);
+                if (!(p[i] & 0x80)) return int(i + 1);
+            }
+            return -1;
+        }
+
+        // Ids must be non negative and below 2^63
+        template<typename T>
+        size_t encode_compact_header(const message_header<T> &header, uint8_t *p) {
+            uint64_t nId = uint64_t(header.id) << 1;
+            size_t n = varint_encode(header.flags ? nId | 1 : nId, p);
+            if (header.flags) p[n++] = header.flags;
+            n += varint_encode(header.size, p + n);
+            return n;
+        }
+
+        // Parse a compact header from the n bytes at p. Returns its length once it is complete, 0 while it isn't,
+        // with nMissing set to how many more bytes it needs at least, and -1 if it is malformed
+        template<typename T>
+        int decode_compact_header(const uint8_t *p, size_t n, message_header<T> &header, size_t &nMissing) {
+            uint64_t nId = 0, nSize = 0;
+            int nIdBytes = varint_decode(p, n, 10, nId);
+            if (nIdBytes < 0) return -1;
+            if (nIdBytes == 0) {
+                // The rest of the id and at least one byte of size
+                nMissing = 2;
+                return 0;
+            }
+
+            size_t nOffset = size_t(nIdBytes);
+            uint8_t nFlags = 0;
+            if (nId & 1) {
+                if (nOffset == n) {
+                    nMissing = 2;
+                    return 0;
+                }
+                nFlags = p[nOffset++];
+            }
+
+            int nSizeBytes = varint_decode(p + nOffset, n - nOffset, 5, nSize);
+            if (nSizeBytes < 0 || nSize > UINT32_MAX) return -1;
+            if (nSizeBytes == 0) {
+                nMissing = 1;
+                return 0;
+            }
+
+            header.id = T(nId >> 1);
+            header.flags = nFlags;
+            header.size = uint32_t(nSize);
+            return int(nOffset) + nSizeBytes;
+        }
+
+        // Connections that agreed on sessions use the compact header with room for an acknowledgement:
+        //   varint((id << 3) | ack only << 2 | has ack << 1 | has flags), [flags byte], [varint ack], varint(size)
+        // The ack is how many more messages arrived since the previous one sent on the connection. A frame that
+        // is ack only carries no message, it is just varint(0b110), varint(ack). Ids must be below 2^61
+        template<typename T>
+        size_t encode_session_header(const message_header<T> *pHeader, uint64_t nAck, uint8_t *p) {
+            if (!pHeader) {
+                size_t n = varint_encode(0b110, p);
+                return n + varint_encode(nAck, p + n);
+            }
+
+            uint64_t nFirst = uint64_t(pHeader->id) << 3;
+            if (nAck) nFirst |= 0b010;
+            if (pHeader->flags) nFirst |= 0b001;
+            size_t n = varint_encode(nFirst, p);
+            if (pHeader->flags) p[n++] = pHeader->flags;
+            if (nAck) n += varint_encode(nAck, p + n);
+            n += varint_encode(pHeader->size, p + n);
+            return n;
+        }
+
+        // Like decode_compact_header(), bMessage is false for a frame that is ack only, nAck 0 if it has no ack
+        template<typename T>
+        int decode_session_header(const uint8_t *p, size_t n, message_header<T> &header, uint64_t &nAck,
+                                  bool &bMessage, size_t &nMissing) {
+            uint64_t nFirst = 0, nSize = 0;
+            int nFirstBytes = varint_decode(p, n, 10, nFirst);
+            if (nFirstBytes < 0) return -1;
+            if (nFirstBytes == 0) {
+                nMissing = 2;
+                return 0;
+            }
+
+            size_t nOffset = size_t(nFirstBytes);
+            bMessage = !(nFirst & 0b100);
+            if (!bMessage && nFirst != 0b110) return -1;
+
+            uint8_t nFlags = 0;
+            if (nFirst & 0b001) {
+                if (nOffset == n) {
+                    nMissing = 2;
+                    return 0;
+                }
+                nFlags = p[nOffset++];
+            }
+
+            nAck = 0;
+            if (nFirst & 0b010) {
+                int nAckBytes = varint_decode(p + nOffset, n - nOffset, 10, nAck);
+                if (nAckBytes < 0) return -1;
+                if (nAckBytes == 0) {
+                    nMissing = bMessage ? 2 : 1;
+                    return 0;
+                }
+                nOffset += size_t(nAckBytes);
+            }
+            if (!bMessage) return int(nOffset);
+
+            int nSizeBytes = varint_decode(p + nOffset, n - nOffset, 5, nSize);
+            if (nSizeBytes < 0 || nSize > UINT32_MAX) return -1;
+            if (nSizeBytes == 0) {
+                nMissing = 1;
+                return 0;
+            }
+
+            header.id = T(nFirst >> 3);
+            header.flags = nFlags;
+            header.size = uint32_t(nSize);
+            return int(nOffset) + nSizeBytes;
+        }
+
+        // Exchanged after the hellos when both sides agreed on sessions. The client sends the token of the
+        // session it wants to resume, 0 for a new one, and how many messages it received in it. The server
+        // answers with the token of the session the connection continues and how many messages it received in
+        // it, so each side knows where to resume sending. Both are little endian
+        struct session_hello {
+            uint64_t nToken = 0;
+            uint64_t nReceived = 0;
+        };
+
+        constexpr size_t SESSION_HELLO_SIZE = 16;
+
+        inline void encode_session_hello(const session_hello &hello, uint8_t *p) {
+            for (size_t i = 0; i < 8; i++) {
+                p[i] = uint8_t(hello.nToken >> (8 * i));
+                p[8 + i] = uint8_t(hello.nReceived >> (8 * i));
+            }
+        }
+
+        inline session_hello decode_session_hello(const uint8_t *p) {
+            session_hello hello;
+            for (size_t i = 0; i < 8; i++) {
+                hello.nToken |= uint64_t(p[i]) << (8 * i);
+                hello.nReceived |= uint64_t(p[8 + i]) << (8 * i);
+            }
+            return hello;
+        }
+    }
+}
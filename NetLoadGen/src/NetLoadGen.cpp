@@ -0,0 +1,287 @@
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <bsl_net.h>
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Message ids are sent as configured, so any enum with a 32 bit underlying type on the server side matches
+using LoadClient = bsl::net::client_interface<uint32_t>;
+
+using Clock = std::chrono::steady_clock;
+
+
+// One kind of message in the mix: its id, body size, and how often it is picked relative to the others
+struct MixEntry {
+    uint32_t nId = 0;
+    size_t nSize = 0;
+    double dWeight = 1.0;
+};
+
+struct Options {
+    std::string sHost = "127.0.0.1";
+    uint16_t nPort = 2696;
+    size_t nClients = 1000;
+    size_t nThreads = std::max(1u, std::thread::hardware_concurrency());
+    double dSeconds = 10.0;
+    double dRate = 10.0;
+    std::vector<MixEntry> vMix{{0, 64, 1.0}};
+    bool bServer = false;
+    std::string sTrace;
+    uint32_t nTraceEvery = 100;
+    bsl::net::wire_format wireFormat = bsl::net::wire_format::legacy;
+};
+
+// Every body ends with the steady clock time it was sent at, so echoed replies give the round trip time
+constexpr size_t STAMP_SIZE = sizeof(int64_t);
+
+
+// Echoes everything back, for running the generator against itself
+class EchoServer : public bsl::net::server_interface<uint32_t> {
+public:
+    EchoServer(uint16_t nPort) : bsl::net::server_interface<uint32_t>(nPort) {
+
+    }
+
+    void Run() {
+        thrUpdate = std::thread([this]() {
+            while (bRunning)
+                Update(-1, true);
+        });
+    }
+
+    void Shutdown() {
+        bRunning = false;
+        // Unblock Update() with a message that has no remote
+        m_qMessagesIn.push_back({});
+        if (thrUpdate.joinable()) thrUpdate.join();
+        Stop();
+    }
+
+protected:
+    virtual void OnMessage(std::shared_ptr<bsl::net::connection<uint32_t>> client, bsl::net::message<uint32_t> &msg) {
+        if (client) client->Send(msg);
+    }
+
+private:
+    std::atomic<bool> bRunning{true};
+    std::thread thrUpdate;
+};
+
+
+// "id:size[:weight],..." e.g. "2:8:70,3:4096:30"
+std::vector<MixEntry> ParseMix(const std::string &sMix) {
+    std::vector<MixEntry> vMix;
+    std::stringstream ssMix(sMix);
+    std::string sEntry;
+    while (std::getline(ssMix, sEntry, ',')) {
+        std::stringstream ssEntry(sEntry);
+        std::string sField;
+        MixEntry entry;
+        if (std::getline(ssEntry, sField, ':')) entry.nId = uint32_t(std::stoul(sField));
+        if (std::getline(ssEntry, sField, ':')) entry.nSize = std::stoul(sField);
+        if (std::getline(ssEntry, sField, ':')) entry.dWeight = std::stod(sField);
+        vMix.push_back(entry);
+    }
+    return vMix;
+}
+
+bool ParseOptions(int argc, char *argv[], Options &options) {
+    for (int i = 1; i < argc; i++) {
+        std::string sArg = argv[i];
+        auto value = [&]() { return i + 1 < argc ? std::string(argv[++i]) : std::string(); };
+
+        if (sArg == "--host") options.sHost = value();
+        else if (sArg == "--port") options.nPort = uint16_t(std::stoul(value()));
+        else if (sArg == "--clients") options.nClients = std::stoul(value());
+        else if (sArg == "--threads") options.nThreads = std::max<size_t>(1, std::stoul(value()));
+        else if (sArg == "--seconds") options.dSeconds = std::stod(value());
+        else if (sArg == "--rate") options.dRate = std::stod(value());
+        else if (sArg == "--mix") options.vMix = ParseMix(value());
+        else if (sArg == "--server") options.bServer = true;
+        else if (sArg == "--trace") options.sTrace = value();
+        else if (sArg == "--trace-every") options.nTraceEvery = uint32_t(std::stoul(value()));
+        else if (sArg == "--compact") options.wireFormat = bsl::net::wire_format::compact;
+        else return false;
+    }
+    return !options.vMix.empty();
+}
+
+// Tens of thousands of sockets need more descriptors than the usual default
+void RaiseDescriptorLimit() {
+#ifndef _WIN32
+    rlimit limit{};
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+#endif
+}
+
+double Percentile(const std::vector<int64_t> &vSorted, double dPercentile) {
+    if (vSorted.empty()) return 0.0;
+    size_t nIndex = std::min(vSorted.size() - 1, size_t(dPercentile / 100.0 * double(vSorted.size())));
+    return double(vSorted[nIndex]) / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        std::cout << "Usage: NetLoadGen [--host H] [--port P] [--clients N] [--threads T] [--seconds S]\n"
+                  << "                  [--rate msgs/s per client] [--mix id:size[:weight],...] [--compact] [--server]\n"
+                  << "                  [--trace file.json] [--trace-every N]\n"
+                  << "  --compact negotiates the compact wire format, the server has to support it\n"
+                  << "  --server also runs an echo server on the port, to measure the library against itself\n"
+                  << "  --trace times 1 of every N messages through the echo server's stages, prints the per stage\n"
+                  << "          latencies and writes the spans for chrome://tracing or Perfetto\n";
+        return 1;
+    }
+
+    RaiseDescriptorLimit();
+
+    std::unique_ptr<EchoServer> pServer;
+    if (options.bServer) {
+        pServer = std::make_unique<EchoServer>(options.nPort);
+        pServer->SetWireFormat(bsl::net::wire_format::compact);
+        if (!options.sTrace.empty())
+            pServer->StartTrace(options.nTraceEvery);
+        pServer->Start();
+        pServer->Run();
+    }
+
+    // All clients share one context, run by a small pool of threads
+    asio::io_context context;
+    auto work = asio::make_work_guard(context);
+    std::vector<std::thread> vThreads;
+    for (size_t i = 0; i < options.nThreads; i++)
+        vThreads.emplace_back([&context]() { context.run(); });
+
+    std::vector<std::unique_ptr<LoadClient>> vClients;
+    vClients.reserve(options.nClients);
+    auto tConnectStart = Clock::now();
+    for (size_t i = 0; i < options.nClients; i++) {
+        auto pClient = std::make_unique<LoadClient>(context);
+        pClient->SetWireFormat(options.wireFormat);
+        if (pClient->Connect(options.sHost, options.nPort))
+            vClients.push_back(std::move(pClient));
+    }
+    double dConnectSeconds = std::chrono::duration<double>(Clock::now() - tConnectStart).count();
+    std::cout << "[LOADGEN] " << vClients.size() << "/" << options.nClients << " clients connecting on "
+              << options.nThreads << " threads, " << vClients.size() / dConnectSeconds << " connects/s\n";
+    if (vClients.empty()) return 1;
+
+    std::atomic<bool> bSending{true}, bReceiving{true};
+    std::atomic<size_t> nSent{0}, nSentBytes{0};
+    std::atomic<size_t> nReceived{0};
+    size_t nReceivedBytes = 0;
+    std::vector<int64_t> vLatencies;
+
+    // Drain every client's queue, the stamp at the end of a reply tells how long the round trip took
+    std::thread thrReceive([&]() {
+        while (bReceiving) {
+            bool bIdle = true;
+            for (auto &pClient : vClients) {
+                while (!pClient->Incoming().empty()) {
+                    auto msg = pClient->Incoming().pop_front().msg;
+                    nReceived++;
+                    nReceivedBytes += sizeof(msg.header) + msg.size();
+                    if (msg.size() >= STAMP_SIZE) {
+                        int64_t nStamp;
+                        std::memcpy(&nStamp, msg.body.data() + msg.size() - STAMP_SIZE, STAMP_SIZE);
+                        vLatencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                Clock::now().time_since_epoch()).count() - nStamp);
+                    }
+                    bIdle = false;
+                }
+            }
+            if (bIdle) std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    });
+
+    // Pace the aggregate rate in 1ms steps, spreading the messages round robin over the clients
+    std::thread thrSend([&]() {
+        std::mt19937 rng(42);
+        std::vector<double> vWeights;
+        for (auto &entry : options.vMix) vWeights.push_back(entry.dWeight);
+        std::discrete_distribution<size_t> pick(vWeights.begin(), vWeights.end());
+
+        double dTotalRate = options.dRate * double(vClients.size());
+        size_t nNextClient = 0;
+        auto tStart = Clock::now();
+        while (bSending) {
+            double dElapsed = std::chrono::duration<double>(Clock::now() - tStart).count();
+            size_t nDue = size_t(dElapsed * dTotalRate);
+
+            while (nSent < nDue) {
+                const MixEntry &entry = options.vMix[pick(rng)];
+                bsl::net::message<uint32_t> msg;
+                msg.header.id = entry.nId;
+                msg.body.resize(std::max(entry.nSize, STAMP_SIZE));
+                int64_t nStamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        Clock::now().time_since_epoch()).count();
+                std::memcpy(msg.body.data() + msg.size() - STAMP_SIZE, &nStamp, STAMP_SIZE);
+                msg.header.size = uint32_t(msg.size());
+
+                vClients[nNextClient]->Send(msg);
+                nNextClient = (nNextClient + 1) % vClients.size();
+                nSent++;
+                nSentBytes += sizeof(msg.header) + msg.size();
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    auto tStart = Clock::now();
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.dSeconds));
+    bSending = false;
+    thrSend.join();
+    double dSendSeconds = std::chrono::duration<double>(Clock::now() - tStart).count();
+
+    // Wait for replies still in flight, for as long as they keep coming
+    size_t nLastReceived = nReceived;
+    auto tLastProgress = Clock::now();
+    while (nReceived < nSent && Clock::now() - tLastProgress < std::chrono::seconds(1)) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        if (nReceived != nLastReceived) {
+            nLastReceived = nReceived;
+            tLastProgress = Clock::now();
+        }
+    }
+    bReceiving = false;
+    thrReceive.join();
+
+    size_t nConnected = 0;
+    for (auto &pClient : vClients)
+        if (pClient->IsConnected()) nConnected++;
+
+    std::sort(vLatencies.begin(), vLatencies.end());
+    std::cout << "[LOADGEN] " << nConnected << " clients still connected\n"
+              << "[LOADGEN] sent " << nSent << " msgs, " << nSent / dSendSeconds << " msgs/s, "
+              << nSentBytes / dSendSeconds / (1024 * 1024) << " MiB/s\n"
+              << "[LOADGEN] received " << nReceived << " msgs, " << nReceived / dSendSeconds << " msgs/s, "
+              << nReceivedBytes / dSendSeconds / (1024 * 1024) << " MiB/s\n"
+              << "[LOADGEN] latency us: p50 " << Percentile(vLatencies, 50) << ", p90 " << Percentile(vLatencies, 90)
+              << ", p99 " << Percentile(vLatencies, 99) << ", p99.9 " << Percentile(vLatencies, 99.9)
+              << ", max " << Percentile(vLatencies, 100) << "\n";
+
+    // Clients close on the shared context, so it has to keep running until all of them are gone
+    vClients.clear();
+    work.reset();
+    context.stop();
+    for (auto &thread : vThreads)
+        thread.join();
+
+    if (pServer && !options.sTrace.empty()) {
+        pServer->StopTrace();
+        std::cout << "[LOADGEN] server stages:\n";
+        pServer->GetTracer().Report(std::cout);
+        if (!pServer->GetTracer().WriteChromeTrace(options.sTrace))
+            std::cout << "[LOADGEN] Trace Write Fail.\n";
+    }
+
+    if (pServer) pServer->Shutdown();
+    return 0;
+}
@@ -0,0 +1,157 @@
+#include <iostream>
+#include <map>
+#include <string>
+#include <bsl_net.h>
+
+// Captures record ids as 64 bit values, they are replayed as 32 bit ids, which covers any enum of up to 32 bits
+using ReplayClient = bsl::net::client_interface<uint32_t>;
+
+using Clock = std::chrono::steady_clock;
+
+
+int main(int argc, char *argv[]) {
+    if (argc < 4) {
+        std::cout << "Usage: NetReplay <capture> <host> <port> [speed] [threads]\n"
+                  << "  speed: 1 replays at the recorded pace, N is N times faster, 0 is as fast as possible\n"
+                  << "  threads: threads running the connections, one per core by default\n";
+        return 1;
+    }
+
+    std::string sPath = argv[1];
+    std::string sHost = argv[2];
+    uint16_t nPort = uint16_t(std::stoul(argv[3]));
+    double dSpeed = argc > 4 ? std::stod(argv[4]) : 1.0;
+    size_t nThreads = argc > 5 ? std::max<size_t>(1, std::stoul(argv[5]))
+                               : std::max(1u, std::thread::hardware_concurrency());
+
+    bsl::net::capture_reader reader;
+    if (!reader.Open(sPath)) {
+        std::cerr << "[REPLAY] Can't read capture " << sPath << "\n";
+        return 1;
+    }
+
+    if (reader.Header().nMessageHeaderSize != sizeof(bsl::net::capture_message_header)) {
+        std::cerr << "[REPLAY] Capture uses a " << reader.Header().nMessageHeaderSize
+                  << " byte message header, expected " << sizeof(bsl::net::capture_message_header) << "\n";
+        return 1;
+    }
+
+    // Replay what was sent towards the server: inbound frames of a server capture, outbound ones of a client capture
+    auto towardsServer = reader.Header().nRole == 0 ? bsl::net::capture_direction::inbound
+                                                    : bsl::net::capture_direction::outbound;
+
+    // All clients share one context, run by a small pool of threads
+    asio::io_context context;
+    auto work = asio::make_work_guard(context);
+    std::vector<std::thread> vThreads;
+    for (size_t i = 0; i < nThreads; i++)
+        vThreads.emplace_back([&context]() { context.run(); });
+
+    // One client per recorded connection, connected when its first frame comes up
+    std::map<uint32_t, std::unique_ptr<ReplayClient>> mapClients;
+    bool bFailed = false;
+
+    bsl::net::capture_record record;
+    const uint8_t *pFrame = nullptr;
+    uint64_t nFirstTimestamp = 0;
+    size_t nFrames = 0, nBytes = 0, nDropped = 0;
+    Clock::duration maxLag{0};
+
+    auto tStart = Clock::now();
+    while (reader.Next(record, pFrame)) {
+        if (record.direction != towardsServer || record.nFrameSize < sizeof(bsl::net::capture_message_header))
+            continue;
+
+        // Hold the frame back until its scaled time comes. Writers on several threads may record a frame with an
+        // earlier timestamp after a later one, it is due right away
+        if (nFrames == 0) nFirstTimestamp = record.nTimestamp;
+        if (dSpeed > 0) {
+            uint64_t nOffset = record.nTimestamp > nFirstTimestamp ? record.nTimestamp - nFirstTimestamp : 0;
+            auto tDue = tStart + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::nanoseconds(uint64_t(double(nOffset) / dSpeed)));
+            auto tNow = Clock::now();
+            if (tDue > tNow)
+                std::this_thread::sleep_until(tDue);
+            else
+                maxLag = std::max(maxLag, tNow - tDue);
+        }
+
+        auto &pClient = mapClients[record.nConnectionId];
+        if (!pClient) {
+            pClient = std::make_unique<ReplayClient>(context);
+            if (!pClient->Connect(sHost, nPort)) {
+                std::cerr << "[REPLAY] Can't connect to " << sHost << ":" << nPort << "\n";
+                bFailed = true;
+                break;
+            }
+        }
+
+        nFrames++;
+        nBytes += record.nFrameSize;
+
+        // Replies are of no interest, don't let them pile up
+        if (nFrames % 1024 == 0)
+            for (auto &client : mapClients)
+                client.second->Incoming().clear();
+
+        // The connection failed or the server closed it, the client would drop the frame
+        if (!pClient->IsConnected()) {
+            nDropped++;
+            continue;
+        }
+
+        bsl::net::message<uint32_t> msg;
+        bsl::net::capture_message_header header;
+        std::memcpy(&header, pFrame, sizeof(header));
+        msg.header = bsl::net::capture_decode_header<uint32_t>(header);
+        msg.body.assign(pFrame + sizeof(header), pFrame + record.nFrameSize);
+        msg.header.size = uint32_t(msg.body.size());
+        pClient->Send(msg);
+    }
+
+    // Wait for everything to leave the outbound queues. Sends are posted to the clients' contexts, give the last
+    // ones a moment to reach the queues first. The queues of clients that failed to connect or were closed by the
+    // server never drain, only the connected ones are waited for, and only as long as they make progress
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    auto pending = [&](bool bConnected) {
+        size_t nPending = 0;
+        for (auto &client : mapClients)
+            if (client.second->IsConnected() == bConnected)
+                for (size_t lane = 0; lane < bsl::net::PRIORITY_LANES; lane++)
+                    nPending += client.second->GetQueueDepth(bsl::net::priority(lane));
+        return nPending;
+    };
+    size_t nLastPending = 0;
+    auto tProgress = Clock::now();
+    while (size_t nPending = pending(true)) {
+        if (nPending != nLastPending) {
+            nLastPending = nPending;
+            tProgress = Clock::now();
+        } else if (Clock::now() - tProgress > std::chrono::seconds(5)) {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    size_t nUnsent = nDropped + pending(true) + pending(false);
+    size_t nClosed = 0;
+    for (auto &client : mapClients)
+        if (!client.second->IsConnected()) nClosed++;
+
+    double dSeconds = std::chrono::duration<double>(Clock::now() - tStart).count();
+    std::cout << "[REPLAY] " << nFrames << " frames, " << nBytes << " bytes over " << mapClients.size()
+              << " connections in " << dSeconds << "s\n"
+              << "[REPLAY] " << nFrames / dSeconds << " frames/s, " << nBytes / dSeconds / (1024 * 1024) << " MiB/s"
+              << ", max lag " << std::chrono::duration<double, std::milli>(maxLag).count() << "ms\n";
+    if (nUnsent > 0 || nClosed > 0)
+        std::cout << "[REPLAY] " << nUnsent << " frames left unsent, " << nClosed << " of " << mapClients.size()
+                  << " connections closed early\n";
+
+    // Clients close on the shared context, so it has to keep running until all of them are gone
+    mapClients.clear();
+    work.reset();
+    context.stop();
+    for (auto &thread : vThreads)
+        thread.join();
+
+    return bFailed ? 1 : 0;
+}
@@ -12,6 +12,11 @@ enum class CustomMsgTypes : uint32_t {
 
 class CustomClient : public bsl::net::client_interface<CustomMsgTypes> {
 public:
+    CustomClient() {
+        // Pings go ahead of other traffic
+        SetPriority(CustomMsgTypes::ServerPing, bsl::net::priority::control);
+    }
+
     void PingServer() {
         bsl::net::message<CustomMsgTypes> msg;
         msg.header.id = CustomMsgTypes::ServerPing;
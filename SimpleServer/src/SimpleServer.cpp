@@ -13,7 +13,7 @@ enum class CustomMsgTypes : uint32_t {
 class CustomServer : public bsl::net::server_interface<CustomMsgTypes> {
 public:
     CustomServer(uint16_t nPort) : bsl::net::server_interface<CustomMsgTypes>(nPort) {
-
+        SetPriority(CustomMsgTypes::ServerPing, bsl::net::priority::control);
     }
 
 protected: